@@ -0,0 +1,128 @@
+#include "bptree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// Log-linear histogram of latencies in nanoseconds: 16 linear buckets per power of two
+class Histogram
+{
+public:
+    void add(const std::uint64_t ns)
+    {
+        const std::size_t i = bucket(ns);
+        if (i >= counts.size()) {
+            counts.resize(i + 1);
+        }
+        counts[i]++;
+        total++;
+        max = std::max(max, ns);
+    }
+
+    // Upper bound of the bucket the given fraction of samples falls into
+    std::uint64_t percentile(const double fraction) const
+    {
+        const auto target = static_cast<std::uint64_t>(fraction * total);
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen > target) {
+                return std::min(upper(i), max);
+            }
+        }
+        return max;
+    }
+
+    std::uint64_t maximum() const
+    {
+        return max;
+    }
+
+private:
+    static constexpr std::size_t sub_buckets = 16;
+
+    static std::size_t bucket(const std::uint64_t ns)
+    {
+        if (ns < sub_buckets) {
+            return ns;
+        }
+        std::size_t log = 0;
+        while ((ns >> log) >= 2 * sub_buckets) {
+            log++;
+        }
+        return (log + 1) * sub_buckets + (ns >> log) - sub_buckets;
+    }
+
+    static std::uint64_t upper(const std::size_t i)
+    {
+        if (i < sub_buckets) {
+            return i;
+        }
+        const std::size_t log = i / sub_buckets - 1;
+        return ((i % sub_buckets + sub_buckets + 1) << log) - 1;
+    }
+
+    std::vector<std::uint64_t> counts;
+    std::uint64_t total = 0;
+    std::uint64_t max = 0;
+};
+
+template <class F>
+std::uint64_t timed(F && f)
+{
+    const auto start = clock_type::now();
+    f();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+}
+
+void report(const std::string & name, const Histogram & histogram)
+{
+    std::cout << name << ": p50 " << histogram.percentile(0.5) << "ns, p99 " << histogram.percentile(0.99)
+              << "ns, p99.9 " << histogram.percentile(0.999) << "ns, p99.99 " << histogram.percentile(0.9999)
+              << "ns, max " << histogram.maximum() << "ns\n";
+}
+
+void run(const bool preemptive, const std::vector<std::uint64_t> & keys)
+{
+    BPTree<std::uint64_t, std::uint64_t> tree;
+    tree.set_preemptive(preemptive);
+    Histogram inserts;
+    Histogram erases;
+    for (const auto key : keys) {
+        inserts.add(timed([&] {
+            tree.insert(key, key);
+        }));
+    }
+    for (const auto key : keys) {
+        erases.add(timed([&] {
+            tree.erase(key);
+        }));
+    }
+    const std::string mode = preemptive ? "preemptive" : "bottom-up";
+    report(mode + " insert", inserts);
+    report(mode + " erase", erases);
+}
+
+} // anonymous namespace
+
+// Per-operation latency of random inserts followed by random erases, in both structural modes
+int main(int argc, char ** argv)
+{
+    const std::size_t count = argc > 1 ? std::stoull(argv[1]) : 2'000'000;
+    std::mt19937_64 rng(42);
+    std::vector<std::uint64_t> keys(count);
+    for (auto & key : keys) {
+        key = rng();
+    }
+    run(false, keys);
+    run(true, keys);
+}
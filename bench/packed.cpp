@@ -0,0 +1,68 @@
+#include "packed_tree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// Nanoseconds per lookup of the given keys, the best of a few rounds
+template <class Tree>
+double lookups(const Tree & tree, const std::vector<std::uint64_t> & keys, std::size_t & found)
+{
+    double res = 0;
+    for (int round = 0; round < 5; ++round) {
+        const auto start = clock_type::now();
+        for (const auto key : keys) {
+            found += tree.contains(key) ? 1 : 0;
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+        const double per_key = static_cast<double>(ns) / keys.size();
+        res = round == 0 ? per_key : std::min(res, per_key);
+    }
+    return res;
+}
+
+void run(const std::size_t count)
+{
+    std::mt19937_64 rng(42);
+    BPTree<std::uint64_t, std::uint32_t> tree;
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> items;
+    std::uint64_t key = 1'600'000'000'000;
+    for (std::size_t i = 0; i < count; ++i) {
+        key += 1 + rng() % 1000;
+        items.emplace_back(key, static_cast<std::uint32_t>(i));
+    }
+    tree = BPTree<std::uint64_t, std::uint32_t>::from_sorted(items.begin(), items.end());
+    const PackedBPTree<std::uint64_t, std::uint32_t> packed(items.begin(), items.end());
+
+    std::vector<std::uint64_t> probes(count);
+    for (auto & probe : probes) {
+        probe = items[rng() % count].first + (rng() % 4 == 0 ? 1 : 0);
+    }
+    std::size_t found = 0;
+    const double tree_ns = lookups(tree, probes, found);
+    const double packed_ns = lookups(packed, probes, found);
+
+    const std::size_t per_leaf = Leaf<std::uint64_t, std::uint32_t, std::less<std::uint64_t>>::max_size;
+    std::cout << count << " keys: entries per 4 KiB leaf: BPTree " << per_leaf << ", packed "
+              << count / packed.leaf_count() << "; lookup: BPTree " << tree_ns << "ns, packed " << packed_ns
+              << "ns (" << found << " found)\n";
+}
+
+} // anonymous namespace
+
+// Space and random lookup cost of packed leaves against BPTree on dense timestamp-like keys, for a
+// set that fits into the caches and one that does not
+int main(int argc, char ** argv)
+{
+    run(32'768);
+    run(argc > 1 ? std::stoull(argv[1]) : 1'000'000);
+}
@@ -1,15 +1,43 @@
 #pragma once
 
+#include "epoch.h"
+#include "hot_cache.h"
+#include "key_filter.h"
 #include "node.h"
 #include "tree_iterator.h"
+#include "value_arena.h"
+#include "write_batch.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <exception>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
+#include <optional>
 #include <set>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
 
-template <class Key, class Value, class Less = std::less<Key>>
+template <class Key, class Value, class Less>
+class FrozenBPTree;
+
+template <class Key, class Value, class Less>
+class Cursor;
+
+// Allocator is std::allocator or a std::pmr::polymorphic_allocator, its default is declared in node.h
+template <class Key, class Value, class Less = std::less<Key>, class Allocator>
 class BPTree
 {
+    static_assert(std::is_same_v<Allocator, std::allocator<std::pair<const Key, Value>>> ||
+                          std::is_same_v<Allocator, std::pmr::polymorphic_allocator<typename Allocator::value_type>>,
+                  "BPTree supports std::allocator and std::pmr::polymorphic_allocator");
 
 public:
     static constexpr std::size_t block_size = 4096;
@@ -21,15 +49,25 @@ public:
     using pointer = value_type *;
     using const_pointer = const value_type *;
     using size_type = std::size_t;
+    using allocator_type = Allocator;
 
     using iterator = tree_iterator<Key, Value, Less, false>;
     using const_iterator = tree_iterator<Key, Value, Less, true>;
 
     BPTree()
-        : size_value(0)
-        , root(new Leaf<Key, Value, Less>)
+        : BPTree(Allocator())
+    {
+    }
+
+    // Nodes and out-of-line values of a tree with a polymorphic allocator come from its memory
+    // resource, keys and values that use allocators are constructed with it
+    explicit BPTree(const Allocator & allocator)
+        : memory(resource_of(allocator))
+        , size_value(0)
+        , root(new (node_resource{memory}) Leaf<Key, Value, Less>)
         , first_leaf(dynamic_cast<Leaf<Key, Value, Less> *>(root))
     {
+        values.use(memory);
     }
 
     BPTree(std::initializer_list<std::pair<const Key, Value>> list)
@@ -41,48 +79,67 @@ public:
         }
     }
 
+    // Copies clone the nodes of the tree instead of inserting its elements one by one
     BPTree(const BPTree & tree)
-        : BPTree()
+        : BPTree(std::allocator_traits<Allocator>::select_on_container_copy_construction(tree.get_allocator()))
     {
-        for (auto i = tree.begin(); i != tree.end(); ++i) {
-            this->insert(i->first, i->second);
-        }
+        clone_from(tree);
     }
 
     BPTree & operator=(const BPTree & tree)
     {
-        this->clear();
-        for (auto i = tree.begin(); i != tree.end(); ++i) {
-            this->insert(i->first, i->second);
+        if (this != &tree) {
+            filter.reset();
+            this->clear();
+            clone_from(tree);
         }
         return *this;
     }
 
+    // Nodes retired by either tree stay on its own list until the readers pinned on that tree are
+    // gone, they do not move with the elements
     BPTree & operator=(BPTree && tree)
     {
         this->clear();
         delete root;
+        // the nodes keep the resource they came from, so the tree takes over the one of the source
+        this->memory = tree.memory;
+        this->values = std::move(tree.values);
         this->size_value = tree.size_value;
+        this->size_stale = tree.size_stale;
         this->root = tree.root;
         this->first_leaf = tree.first_leaf;
-        this->deleted_set = std::move(tree.deleted_set);
-        tree.deleted_set = std::set<Node<Key, Value> *>();
+        this->preemptive_mode = tree.preemptive_mode;
+        this->filter = std::move(tree.filter);
+        this->hot = std::move(tree.hot);
+        this->levels = std::move(tree.levels);
+        this->levels_size = tree.levels_size;
+        tree.levels.clear();
         tree.size_value = 0;
-        tree.root = new Leaf<Key, Value, Less>;
-        tree.first_leaf = dynamic_cast<Leaf<Key, Value, Less> *>(this->root);
+        tree.size_stale = false;
+        tree.root = new (node_resource{tree.memory}) Leaf<Key, Value, Less>;
+        tree.first_leaf = dynamic_cast<Leaf<Key, Value, Less> *>(tree.root);
         return *this;
     }
 
     BPTree(BPTree && tree)
+        : memory(tree.memory)
+        , values(std::move(tree.values))
     {
         this->size_value = tree.size_value;
+        this->size_stale = tree.size_stale;
         this->root = tree.root;
         this->first_leaf = tree.first_leaf;
-        this->deleted_set = std::move(tree.deleted_set);
-        tree.deleted_set = std::set<Node<Key, Value> *>();
+        this->preemptive_mode = tree.preemptive_mode;
+        this->filter = std::move(tree.filter);
+        this->hot = std::move(tree.hot);
+        this->levels = std::move(tree.levels);
+        this->levels_size = tree.levels_size;
+        tree.levels.clear();
         tree.size_value = 0;
-        tree.root = new Leaf<Key, Value, Less>;
-        tree.first_leaf = dynamic_cast<Leaf<Key, Value, Less> *>(this->root);
+        tree.size_stale = false;
+        tree.root = new (node_resource{tree.memory}) Leaf<Key, Value, Less>;
+        tree.first_leaf = dynamic_cast<Leaf<Key, Value, Less> *>(tree.root);
     }
 
     iterator begin()
@@ -120,31 +177,77 @@ public:
         return size() == 0;
     };
 
+    allocator_type get_allocator() const
+    {
+        if constexpr (polymorphic) {
+            return allocator_type(memory);
+        }
+        else {
+            return allocator_type();
+        }
+    }
+
     size_type size() const
     {
+        if (size_stale) {
+            size_value = 0;
+            for (auto * leaf = first_leaf; leaf != nullptr; leaf = leaf->right) {
+                size_value += leaf->size;
+            }
+            size_stale = false;
+        }
         return size_value;
     };
 
     void clear()
     {
-        this->deleted_set.insert(this->root);
-        this->deleted_set.insert(this->first_leaf);
-        delete_tree(this->first_leaf, this->deleted_set);
+        values.clear(begin(), end());
+        auto * old_root = this->root;
         this->size_value = 0;
-        this->root = new Leaf<Key, Value, Less>();
+        this->size_stale = false;
+        this->root = new (node_resource{memory}) Leaf<Key, Value, Less>();
         this->first_leaf = dynamic_cast<Leaf<Key, Value, Less> *>(this->root);
-        for (auto item : this->deleted_set) {
-            delete item;
+        if (filter != nullptr) {
+            rebuild_filter();
+        }
+        if (hot != nullptr) {
+            hot->invalidate();
         }
-        this->deleted_set = std::set<Node<Key, Value> *>();
+        // readers pinned before the clear may still walk the old nodes
+        const std::uint64_t now = epoch();
+        for_each_node(old_root, [this, now](Node<Key, Value, Less> * node) {
+            retired.retire(node, now);
+        });
+        reclaim();
+    }
+
+    // Pins the current epoch: nodes unlinked by the writer are not freed while the guard lives, so
+    // a reader never walks freed node memory. Only whole nodes are deferred: an erase, merge or
+    // rebalance still moves and destroys elements inside live leaves, so iterators and references
+    // taken under a pin may point to other elements or destroyed values once the tree changes
+    Epoch_manager::guard pin() const
+    {
+        return readers().pin();
     }
 
     template <class T>
     T find_impl(const Key & key) const
     {
+        if (filter != nullptr && !filter->may_contain(key)) {
+            return T();
+        }
+        if (hot != nullptr) {
+            const auto cached = hot->find(key);
+            if (cached.first != nullptr) {
+                return T(*cached.first, cached.second);
+            }
+        }
         const auto pair = root->lower(key);
-        const auto leaf = dynamic_cast<Leaf<Key, Value, Less> &>(pair.first);
-        if (leaf[pair.second].first == key) {
+        auto & leaf = dynamic_cast<Leaf<Key, Value, Less> &>(pair.first);
+        if (pair.second < leaf.size && leaf.data[pair.second].first == key) {
+            if (hot != nullptr) {
+                hot->remember(key, &leaf, pair.second);
+            }
             return T(pair.first, pair.second);
         }
         else {
@@ -167,6 +270,36 @@ public:
         return find_impl<const_iterator>(key);
     }
 
+    // Batched lookups: keys are resolved in groups that descend one level at a time, the children
+    // of the whole group are prefetched before any of them is read. A sorted batch also reuses the
+    // slot found for the previous key whenever both descend through the same node.
+    template <class Keys, class OutputIt>
+    OutputIt find_many(const Keys & keys, OutputIt out)
+    {
+        descend_many(std::begin(keys), std::end(keys), [&](const Key & key, Leaf<Key, Value, Less> & leaf, const std::size_t pos) {
+            *out++ = matches(key, leaf, pos) ? iterator(leaf, pos) : end();
+        });
+        return out;
+    }
+
+    template <class Keys, class OutputIt>
+    OutputIt find_many(const Keys & keys, OutputIt out) const
+    {
+        descend_many(std::begin(keys), std::end(keys), [&](const Key & key, Leaf<Key, Value, Less> & leaf, const std::size_t pos) {
+            *out++ = matches(key, leaf, pos) ? const_iterator(leaf, pos) : end();
+        });
+        return out;
+    }
+
+    template <class Keys, class OutputIt>
+    OutputIt contains_many(const Keys & keys, OutputIt out) const
+    {
+        descend_many(std::begin(keys), std::end(keys), [&](const Key & key, Leaf<Key, Value, Less> & leaf, const std::size_t pos) {
+            *out++ = matches(key, leaf, pos);
+        });
+        return out;
+    }
+
     size_type count(const Key & key) const
     {
         if (contains(key)) {
@@ -222,6 +355,103 @@ public:
         return const_iterator(res.first, res.second);
     };
 
+    // Calls visit with every element whose key is in [lo, hi), in order. Descends once and then
+    // walks the slots of each leaf directly. Returns the number of elements visited
+    template <class F>
+    std::size_t scan(const Key & lo, const Key & hi, F && visit) const
+    {
+        std::size_t res = 0;
+        scan_leaves(lo, [&](const auto * leaf, const std::size_t from) {
+            std::size_t to = leaf->size;
+            const bool last = !(leaf->data[to - 1].first < hi);
+            if (last) {
+                to = leaf->position(hi, from);
+            }
+            for (std::size_t i = from; i < to; ++i) {
+                visit(slot::get(leaf->data[i]));
+            }
+            res += to - from;
+            return !last;
+        });
+        return res;
+    }
+
+    // Calls pred with the elements from the first key not less than lo on, until it returns false.
+    // Returns the number of elements pred accepted
+    template <class F>
+    std::size_t scan_while(const Key & lo, F && pred) const
+    {
+        std::size_t res = 0;
+        scan_leaves(lo, [&](const auto * leaf, const std::size_t from) {
+            for (std::size_t i = from; i < leaf->size; ++i) {
+                if (!pred(slot::get(leaf->data[i]))) {
+                    return false;
+                }
+                res++;
+            }
+            return true;
+        });
+        return res;
+    }
+
+    struct range_estimate
+    {
+        std::size_t count = 0;
+        // bounds on the count from the smallest and the largest subtrees per level at the last
+        // statistics refresh
+        std::size_t low = 0;
+        std::size_t high = 0;
+    };
+
+    // Estimated number of keys in [lo, hi) in O(height): the boundary paths of lo and hi are
+    // descended together, the leaves at their ends are counted exactly and every subtree between
+    // the paths is assumed to hold the average number of elements of its level. Node counts per
+    // level are refreshed by a walk over the inner nodes once the size drifted by a sixteenth
+    range_estimate estimate_range(const Key & lo, const Key & hi) const
+    {
+        using leaf_type = Leaf<Key, Value, Less>;
+        using inner_type = Inner_node<Key, Value, Less>;
+        range_estimate res;
+        if (!(lo < hi)) {
+            return res;
+        }
+        std::size_t height = 0;
+        const Node<Key, Value, Less> * node = root;
+        while (const auto * inner = dynamic_cast<const inner_type *>(node)) {
+            node = inner->data[0].second;
+            height++;
+        }
+        const std::size_t total = size();
+        if (levels.size() != height + 1 || 16 * std::max(total, levels_size) - 16 * std::min(total, levels_size) > levels_size) {
+            refresh_levels(height);
+        }
+        double count = 0;
+        const Node<Key, Value, Less> * a = root;
+        const Node<Key, Value, Less> * b = root;
+        for (std::size_t level = height; level > 0; --level) {
+            const auto * x = static_cast<const inner_type *>(a);
+            const auto * y = static_cast<const inner_type *>(b);
+            const std::size_t i = x->child_index(lo);
+            const std::size_t j = y->child_index(hi);
+            const std::size_t whole = x == y ? (j > i ? j - i - 1 : 0) : x->size - 1 - i + j;
+            const auto & stats = levels[level - 1];
+            count += static_cast<double>(whole) * total / stats.nodes;
+            res.low += whole * stats.smallest;
+            res.high += whole * stats.largest;
+            a = x->data[i].second;
+            b = y->data[j].second;
+        }
+        const auto * first = static_cast<const leaf_type *>(a);
+        const auto * last = static_cast<const leaf_type *>(b);
+        const std::size_t from = first->position(lo);
+        const std::size_t to = last->position(hi);
+        const std::size_t exact = first == last ? std::max(to, from) - from : first->size - from + to;
+        res.low += exact;
+        res.high = std::min(res.high + exact, std::max(total, res.low));
+        res.count = std::clamp(static_cast<std::size_t>(count + 0.5) + exact, res.low, res.high);
+        return res;
+    }
+
     // 'at' method throws std::out_of_range if there is no such key
     Value & at(const Key & key)
     {
@@ -267,37 +497,20 @@ public:
 
     std::pair<iterator, bool> insert(const Key & key, const Value & value)
     {
-        const auto res = root->insert(root, std::pair<Key, Value>(key, value));
-        root = std::get<0>(res);
-        if (std::get<3>(res)) {
-            size_value++;
-        }
-        return std::pair<iterator, bool>(iterator(std::get<1>(res), std::get<2>(res)), std::get<3>(res));
+        const auto slot = make_slot(key, value);
+        return inserted(insert_target(slot.first)->insert(root, slot), slot);
     }
 
     std::pair<iterator, bool> insert(const Key & key, Value && value)
     {
-        const auto res = root->insert_move(root, std::pair<Key, Value>(key, std::move(value)));
-        root = std::get<0>(res);
-        if (std::get<3>(res)) {
-            size_value++;
-        }
-        return std::pair<iterator, bool>(iterator(std::get<1>(res), std::get<2>(res)), std::get<3>(res));
+        auto slot = make_slot(key, std::move(value));
+        return inserted(insert_target(slot.first)->insert_move(root, std::move(slot)), slot);
     }
 
     std::pair<iterator, bool> insert(Key && key, Value && value)
     {
-        const auto res = root->insert_move(root,
-                                           std::pair<Key, Value>(
-                                                   std::move(
-                                                           key),
-                                                   std::move(
-                                                           value)));
-        root = std::get<0>(res);
-        if (std::get<3>(res)) {
-            size_value++;
-        }
-        return std::pair<iterator, bool>(iterator(std::get<1>(res), std::get<2>(res)), std::get<3>(res));
+        auto slot = make_slot(std::move(key), std::move(value));
+        return inserted(insert_target(slot.first)->insert_move(root, std::move(slot)), slot);
     }
 
     void insert(std::initializer_list<value_type> list)
@@ -309,12 +522,13 @@ public:
 
     iterator erase(const_iterator it)
     {
+        if (it != cend() && preemptive_mode) {
+            const Key key = it->first;
+            auto * leaf = merge_path(key);
+            return erase_at(leaf, leaf->position(key));
+        }
         if (it != cend()) {
-            auto res = root->erase(root, it);
-            root = std::get<1>(res);
-            size_value--;
-            deleted_set.insert(std::get<2>(res));
-            return std::get<0>(res);
+            return erase_at(const_cast<Leaf<Key, Value, Less> *>(it.node()), it.position());
         }
         else {
             return end();
@@ -323,12 +537,11 @@ public:
 
     iterator erase(iterator it)
     {
+        if (it != end() && preemptive_mode) {
+            return erase(const_iterator(*it.node(), it.position()));
+        }
         if (it != end()) {
-            auto res = root->erase(root, it);
-            root = std::get<1>(res);
-            size_value--;
-            deleted_set.insert(std::get<2>(res));
-            return std::get<0>(res);
+            return erase_at(it.node(), it.position());
         }
         else {
             return end();
@@ -337,6 +550,9 @@ public:
 
     iterator erase(const_iterator begin, const_iterator end)
     {
+        if (begin == end) {
+            return end == cend() ? this->end() : lower_bound(end->first);
+        }
         iterator res;
         std::set<Key> key_set;
         for (auto j = begin; j != end; ++j) {
@@ -350,12 +566,18 @@ public:
 
     size_type erase(const Key & key)
     {
+        if (preemptive_mode) {
+            auto * leaf = merge_path(key);
+            const std::size_t pos = leaf->position(key);
+            if (!matches(key, *leaf, pos)) {
+                return 0;
+            }
+            erase_at(leaf, pos);
+            return 1;
+        }
         const_iterator f = find_const(key);
         if (f != cend()) {
-            auto res = root->erase(root, f);
-            root = std::get<1>(res);
-            size_value--;
-            deleted_set.insert(std::get<2>(res));
+            erase(f);
             return 1;
         }
         else {
@@ -363,15 +585,380 @@ public:
         }
     }
 
-    ~BPTree()
+    // Erases the elements pred accepts in one pass over the leaves: every leaf is compacted in
+    // place, and once the walk leaves the children of an inner node their empty leaves are dropped,
+    // the underfull ones evened out with their neighbours and the node itself repaired.
+    // Returns the number of elements erased
+    template <class F>
+    std::size_t erase_if(F && pred)
+    {
+        return erase_where(first_leaf, 0, nullptr, pred);
+    }
+
+    // Only the elements whose key is in [lo, hi) are offered to pred
+    template <class F>
+    std::size_t erase_if(const Key & lo, const Key & hi, F && pred)
+    {
+        const auto start = root->lower(lo);
+        return erase_where(static_cast<Leaf<Key, Value, Less> *>(&start.first), start.second, &hi, pred);
+    }
+
+    // Keeps only the elements pred accepts
+    template <class F>
+    std::size_t retain(F && pred)
+    {
+        return erase_if([&pred](const auto & item) {
+            return !pred(item);
+        });
+    }
+
+    // In preemptive mode inserts split full inner nodes and erases even out minimal ones on the way
+    // down, so the repair after the leaf is changed stops at its parent instead of cascading up
+    // to the root
+    void set_preemptive(const bool value)
+    {
+        preemptive_mode = value;
+    }
+
+    bool preemptive() const
+    {
+        return preemptive_mode;
+    }
+
+    // Keeps a Bloom filter over the keys, so that find, contains, count and at reject most
+    // absent keys without descending to a leaf. Costs 16 bits per key and a hash per update
+    void set_filter(const bool value)
+    {
+        static_assert(Key_filter<Key>::supported, "filters need keys supported by std::hash");
+        filter.reset();
+        if (value) {
+            rebuild_filter();
+        }
+    }
+
+    bool filtered() const
+    {
+        return filter != nullptr;
+    }
+
+    // Keeps a front cache of the leaf slots of up to entries recently found keys, so that find,
+    // contains, count and at skip the descent for hot keys. A cache line holds four entries,
+    // 0 turns the cache off
+    void set_hot_cache(const std::size_t entries)
+    {
+        static_assert(Hot_cache<Key, Value, Less>::supported, "hot caches need keys supported by std::hash");
+        hot.reset();
+        if (entries > 0) {
+            hot = std::make_unique<Hot_cache<Key, Value, Less>>(entries);
+        }
+    }
+
+    std::size_t hot_cache_capacity() const
+    {
+        return hot != nullptr ? hot->capacity() : 0;
+    }
+
+    // Hits, misses and invalidations of the front cache since it was set, all zero without one
+    typename Hot_cache<Key, Value, Less>::stats hot_cache_stats() const
+    {
+        return hot != nullptr ? hot->statistics() : typename Hot_cache<Key, Value, Less>::stats();
+    }
+
+    // Applies all operations of the batch in key order with one pass over the leaves they touch
+    void apply(WriteBatch<Key, Value> batch)
+    {
+        auto items = batch.take_sorted();
+        apply_sorted(items.begin(), items.end());
+    }
+
+    // Builds a tree from a sorted range of unique key-value pairs bottom up: the elements are
+    // spread evenly over the fewest leaves that hold them at rest, then every level of inner nodes
+    // is packed the same way over the one below
+    template <class It>
+    static BPTree from_sorted(It first, const It last, const Allocator & allocator = Allocator())
+    {
+        if (std::adjacent_find(first, last, [](const auto & lhs, const auto & rhs) {
+                return !(lhs.first < rhs.first);
+            }) != last) {
+            throw std::invalid_argument("BPTree: keys are not sorted and unique");
+        }
+        return build_sorted(std::distance(first, last), allocator, [&first](BPTree & res) {
+            auto slot = res.make_slot(first->first, first->second);
+            ++first;
+            return slot;
+        });
+    }
+
+    // Merge-based set operations on the keys of two trees. Both leaf chains are walked in
+    // lockstep: the side that is behind catches up by a search in its current or next leaf, or by
+    // a descent from the root when the other key is further away, so runs of keys missing on one
+    // side are skipped whole. The result is bulk built and takes the values of this tree
+    BPTree set_intersection(const BPTree & tree) const
+    {
+        std::vector<const slot_type *> items;
+        leaf_cursor lhs(*this);
+        leaf_cursor rhs(tree);
+        while (lhs.valid() && rhs.valid()) {
+            if (lhs.key() < rhs.key()) {
+                lhs.seek(rhs.key());
+            }
+            else if (rhs.key() < lhs.key()) {
+                rhs.seek(lhs.key());
+            }
+            else {
+                items.push_back(&lhs.item());
+                lhs.next();
+                rhs.next();
+            }
+        }
+        return build_from(items);
+    }
+
+    BPTree set_union(const BPTree & tree) const
+    {
+        std::vector<const slot_type *> items;
+        unite(*this, tree, items);
+        return build_from(items);
+    }
+
+    BPTree set_difference(const BPTree & tree) const
+    {
+        std::vector<const slot_type *> items;
+        leaf_cursor lhs(*this);
+        leaf_cursor rhs(tree);
+        while (lhs.valid()) {
+            if (!rhs.valid() || lhs.key() < rhs.key()) {
+                items.push_back(&lhs.item());
+                lhs.next();
+            }
+            else if (rhs.key() < lhs.key()) {
+                rhs.seek(lhs.key());
+            }
+            else {
+                lhs.next();
+                rhs.next();
+            }
+        }
+        return build_from(items);
+    }
+
+    // Adds the elements of this tree whose keys are not in target yet, target keeps its values.
+    // Target is rebuilt from both trees and keeps its settings
+    void merge_into(BPTree & target) const
+    {
+        if (&target == this) {
+            return;
+        }
+        std::vector<const slot_type *> items;
+        unite(target, *this, items);
+        BPTree res = target.build_from(items);
+        res.preemptive_mode = target.preemptive_mode;
+        const bool filtered = target.filtered();
+        const std::size_t hot_capacity = target.hot_cache_capacity();
+        target = std::move(res);
+        if (filtered) {
+            target.rebuild_filter();
+        }
+        if (hot_capacity > 0) {
+            target.hot = std::make_unique<Hot_cache<Key, Value, Less>>(hot_capacity);
+        }
+    }
+
+    // Incremental defragmentation for trees thinned out by erases: every run of sibling leaves is
+    // repacked to 7/8 of their capacity into fresh leaves allocated in key order, so scans walk
+    // memory sequentially. About budget leaves, at least two, are visited per call, the next call
+    // resumes after them. Inner nodes left underfull are evened out and the root drops the levels it no
+    // longer needs. Returns true when a pass over the whole tree is complete, empty node arena
+    // regions are unmapped then and the next call starts a new pass. Iterators are invalidated
+    bool compact(std::size_t budget = std::numeric_limits<std::size_t>::max())
+    {
+        using leaf_type = Leaf<Key, Value, Less>;
+        for (;;) {
+            std::optional<Key> upper;
+            leaf_type * leaf = compact_from ? root->leaf_of(*compact_from, upper) : first_leaf;
+            auto * parent = leaf->parent;
+            if (parent == nullptr) {
+                break;
+            }
+            if (budget == 0) {
+                return false;
+            }
+            const std::size_t k = parent->index_of(leaf);
+            // a single leaf has nothing to be packed with
+            const std::size_t count = std::min(std::max<std::size_t>(budget, 2), parent->size - k);
+            budget -= std::min(budget, count);
+            leaf_type * next = static_cast<leaf_type *>(parent->data[k + count - 1].second)->right;
+            repack(parent, k, count);
+            while (next != nullptr && next->size == 0) {
+                next = next->right;
+            }
+            if (next == nullptr) {
+                break;
+            }
+            compact_from = next->data[0].first;
+        }
+        compact_from.reset();
+        reclaim();
+        Node_arena::instance().trim();
+        return true;
+    }
+
+    // Immutable pointer-free copy of the tree, needs frozen_tree.h
+    FrozenBPTree<Key, Value, Less> freeze() const;
+
+    // Cursor at the first element, needs cursor.h
+    Cursor<Key, Value, Less> cursor() const;
+
+    void swap(BPTree & tree) noexcept
+    {
+        std::swap(memory, tree.memory);
+        values.swap(tree.values);
+        std::swap(size_value, tree.size_value);
+        std::swap(size_stale, tree.size_stale);
+        std::swap(root, tree.root);
+        std::swap(first_leaf, tree.first_leaf);
+        std::swap(preemptive_mode, tree.preemptive_mode);
+        filter.swap(tree.filter);
+        hot.swap(tree.hot);
+        retired.swap(tree.retired);
+        epochs.store(tree.epochs.exchange(epochs.load()));
+        levels.swap(tree.levels);
+        std::swap(levels_size, tree.levels_size);
+    }
+
+    // Moves all elements with keys not less than key to a new tree. Nodes are cut along the single
+    // root-to-leaf path of key, only the nodes on the two cut edges are repaired afterwards.
+    // Sizes of both trees are recounted from the leaf headers the next time they are asked for
+    BPTree split_at(const Key & key)
     {
-        deleted_set.insert(root);
-        deleted_set.insert(first_leaf);
-        delete_tree(first_leaf, deleted_set);
-        for (auto item : deleted_set) {
-            delete item;
+        using inner_type = Inner_node<Key, Value, Less>;
+        BPTree res(get_allocator());
+        res.preemptive_mode = preemptive_mode;
+        // the keys moved to res stay in the filter of this tree, which then just answers
+        // "maybe" for them
+        if (filter != nullptr) {
+            res.filter = std::make_unique<Key_filter<Key>>(*filter);
         }
-        this->deleted_set = std::set<Node<Key, Value> *>();
+        // cached leaves of the moved keys go to res
+        if (hot != nullptr) {
+            hot->invalidate();
+            res.hot = std::make_unique<Hot_cache<Key, Value, Less>>(hot->capacity());
+        }
+        std::vector<std::pair<inner_type *, std::size_t>> path;
+        Node<Key, Value, Less> * node = root;
+        while (auto * inner = dynamic_cast<inner_type *>(node)) {
+            path.emplace_back(inner, inner->child_index(key));
+            node = inner->data[path.back().second].second;
+        }
+
+        auto * leaf = static_cast<Leaf<Key, Value, Less> *>(node);
+        auto * cut = res.first_leaf;
+        const std::size_t pos = leaf->position(key);
+        std::move(leaf->data.begin() + pos, leaf->data.begin() + leaf->size, cut->data.begin());
+        cut->size = leaf->size - pos;
+        leaf->size = pos;
+        cut->right = leaf->right;
+        leaf->right = nullptr;
+
+        const Key & first_key = cut->size > 0 ? cut->data[0].first : key;
+        Node<Key, Value, Less> * child = cut;
+        for (auto i = path.rbegin(); i != path.rend(); ++i) {
+            auto * inner = i->first;
+            auto * new_node = new (near_hint{inner}) inner_type();
+            new_node->data[0] = std::pair<Key, Node<Key, Value> *>(first_key, child);
+            std::move(inner->data.begin() + i->second + 1, inner->data.begin() + inner->size, new_node->data.begin() + 1);
+            new_node->size = inner->size - i->second;
+            inner->size = i->second + 1;
+            for (std::size_t j = 0; j < new_node->size; ++j) {
+                new_node->data[j].second->new_parent(new_node);
+            }
+            child = new_node;
+        }
+        res.root = child;
+        res.values.share(values);
+
+        fix_spine(false);
+        res.fix_spine(true);
+        size_stale = true;
+        res.size_stale = true;
+        return res;
+    }
+
+    // Appends all elements of a tree whose keys are all greater (or all less) than the keys of
+    // this one. The smaller tree is grafted as a single subtree onto the spine of the taller one,
+    // other is left empty
+    void join(BPTree & tree)
+    {
+        using inner_type = Inner_node<Key, Value, Less>;
+        first_leaf = leftmost_leaf();
+        tree.first_leaf = tree.leftmost_leaf();
+        if (tree.root == tree.first_leaf && tree.first_leaf->size == 0) {
+            return;
+        }
+        if (root == first_leaf && first_leaf->size == 0) {
+            swap_contents(tree);
+            joined(tree);
+            return;
+        }
+        if (!(last_leaf()->data[last_leaf()->size - 1].first < tree.first_leaf->data[0].first)) {
+            if (!(tree.last_leaf()->data[tree.last_leaf()->size - 1].first < first_leaf->data[0].first)) {
+                throw std::invalid_argument("join: key ranges overlap");
+            }
+            swap_contents(tree);
+        }
+
+        const Key separator = tree.first_leaf->data[0].first;
+        const std::size_t left_height = height();
+        const std::size_t right_height = tree.height();
+        last_leaf()->right = tree.first_leaf;
+        if (left_height == right_height) {
+            auto * new_root = new (near_hint{root}) inner_type();
+            new_root->data[0] = std::pair<Key, Node<Key, Value> *>(first_leaf->data[0].first, root);
+            new_root->data[1] = std::pair<Key, Node<Key, Value> *>(separator, tree.root);
+            new_root->size = 2;
+            root->new_parent(new_root);
+            tree.root->new_parent(new_root);
+            root = new_root;
+            if (underfull(new_root->data[0].second) || underfull(new_root->data[1].second)) {
+                retire(new_root->balance(0));
+            }
+            collapse_root();
+        }
+        else if (left_height > right_height) {
+            auto * node = static_cast<inner_type *>(root);
+            for (std::size_t i = right_height + 1; i < left_height; ++i) {
+                node = static_cast<inner_type *>(node->data[node->size - 1].second);
+            }
+            root = node->push(root, separator, tree.root);
+            fix_spine(false);
+        }
+        else {
+            auto * node = static_cast<inner_type *>(tree.root);
+            for (std::size_t i = left_height + 1; i < right_height; ++i) {
+                node = static_cast<inner_type *>(node->data[0].second);
+            }
+            node->data[0].first = separator;
+            root = node->push(tree.root, first_leaf->data[0].first, root);
+            fix_spine(true);
+        }
+
+        values.adopt(tree.values);
+        size_value += tree.size_value;
+        size_stale = size_stale || tree.size_stale;
+        tree.size_value = 0;
+        tree.size_stale = false;
+        tree.root = new (node_resource{tree.memory}) Leaf<Key, Value, Less>;
+        tree.first_leaf = dynamic_cast<Leaf<Key, Value, Less> *>(tree.root);
+        joined(tree);
+    }
+
+    ~BPTree()
+    {
+        values.clear(begin(), end());
+        for_each_node(root, [](Node<Key, Value, Less> * node) {
+            delete node;
+        });
+        delete epochs.load();
     }
 
     void delete_tree(Leaf<Key, Value, Less> * tree, std::set<Node<Key, Value> *> & set)
@@ -399,8 +986,1222 @@ public:
     }
 
 private:
-    size_t size_value;
-    Node<Key, Value, Less> * root;
-    Leaf<Key, Value, Less> * first_leaf;
-    std::set<Node<Key, Value> *> deleted_set;
-};
+    template <class, class, class>
+    friend class BufferedBPTree;
+    template <class, class, class>
+    friend class ShardedBPTree;
+    template <class>
+    friend class StringBPTree;
+
+    using slot = leaf_slot<Key, Value>;
+    using slot_type = typename slot::type;
+
+    static constexpr bool polymorphic = !std::is_same_v<Allocator, std::allocator<std::pair<const Key, Value>>>;
+    // keys and values which take an allocator are built with the one of the tree
+    static constexpr bool allocator_aware = polymorphic && (std::uses_allocator_v<Key, Allocator> || std::uses_allocator_v<Value, Allocator>);
+
+    static std::pmr::memory_resource * resource_of(const Allocator & allocator)
+    {
+        if constexpr (polymorphic) {
+            return allocator.resource();
+        }
+        else {
+            return nullptr;
+        }
+    }
+
+    template <class T, class Arg>
+    T with_allocator(Arg && arg) const
+    {
+        if constexpr (!std::uses_allocator_v<T, Allocator>) {
+            return T(std::forward<Arg>(arg));
+        }
+        else if constexpr (std::is_constructible_v<T, std::allocator_arg_t, const Allocator &, Arg>) {
+            return T(std::allocator_arg, get_allocator(), std::forward<Arg>(arg));
+        }
+        else {
+            return T(std::forward<Arg>(arg), get_allocator());
+        }
+    }
+
+    // Moves the elements of count leaves of parent from slot k on into as few fresh leaves as hold
+    // them at the compaction fill, unless that saves no leaf and the leaves already ascend in memory
+    void repack(Inner_node<Key, Value, Less> * parent, const std::size_t k, const std::size_t count)
+    {
+        using leaf_type = Leaf<Key, Value, Less>;
+        constexpr std::size_t fill = std::max<std::size_t>((leaf_type::max_size - 1) * 7 / 8, leaf_type::max_size / 2);
+        std::vector<leaf_type *> old(count);
+        std::size_t total = 0;
+        bool ascending = true;
+        for (std::size_t i = 0; i < count; ++i) {
+            old[i] = static_cast<leaf_type *>(parent->data[k + i].second);
+            total += old[i]->size;
+            ascending = ascending && (i == 0 || std::less<const void *>()(old[i - 1], old[i]));
+        }
+        // leaves fuller than the fill are only evened out with their neighbours
+        const std::size_t fresh_count = std::clamp<std::size_t>((total + fill - 1) / fill, 1, count);
+        if (fresh_count == count && ascending) {
+            return;
+        }
+        leaf_type * left = k > 0 ? static_cast<leaf_type *>(parent->data[k - 1].second) : left_leaf(parent);
+        const Key separator = parent->data[k].first;
+        std::vector<leaf_type *> fresh;
+        fresh.reserve(fresh_count);
+        auto from = old.begin();
+        std::size_t pos = 0;
+        for (std::size_t i = 0; i < fresh_count; ++i) {
+            const Node<Key, Value, Less> * near = fresh.empty() ? (left != nullptr ? static_cast<Node<Key, Value, Less> *>(left) : parent) : fresh.back();
+            auto * leaf = new (near_hint{near}) leaf_type;
+            const std::size_t size = total / fresh_count + (i < total % fresh_count ? 1 : 0);
+            while (leaf->size < size) {
+                if (pos == (*from)->size) {
+                    ++from;
+                    pos = 0;
+                    continue;
+                }
+                const std::size_t n = std::min(size - leaf->size, (*from)->size - pos);
+                std::move((*from)->data.begin() + pos, (*from)->data.begin() + pos + n, leaf->data.begin() + leaf->size);
+                leaf->size += n;
+                pos += n;
+            }
+            leaf->parent = parent;
+            if (!fresh.empty()) {
+                fresh.back()->right = leaf;
+            }
+            fresh.push_back(leaf);
+        }
+        fresh.back()->right = old.back()->right;
+        if (left != nullptr) {
+            left->right = fresh.front();
+        }
+        else {
+            first_leaf = fresh.front();
+        }
+        std::move(parent->data.begin() + k + count, parent->data.begin() + parent->size, parent->data.begin() + k + fresh_count);
+        parent->size -= count - fresh_count;
+        for (std::size_t i = 0; i < fresh_count; ++i) {
+            parent->data[k + i] = std::pair<Key, Node<Key, Value, Less> *>(fresh[i]->size > 0 ? fresh[i]->data[0].first : separator, fresh[i]);
+        }
+        for (auto * leaf : old) {
+            leaf->size = 0;
+            retire(leaf);
+        }
+        if (k == 0 && total > 0) {
+            update_separator(fresh.front());
+        }
+        repair(parent);
+        collapse_root();
+    }
+
+    // Counts the nodes of every level and the elements below them in one walk
+    void refresh_levels(const std::size_t height) const
+    {
+        levels.assign(height + 1, level_stats());
+        count_level(root, height);
+        levels_size = size();
+    }
+
+    std::size_t count_level(const Node<Key, Value, Less> * node, const std::size_t level) const
+    {
+        std::size_t res = 0;
+        if (level == 0) {
+            res = static_cast<const Leaf<Key, Value, Less> *>(node)->size;
+        }
+        else {
+            const auto * inner = static_cast<const Inner_node<Key, Value, Less> *>(node);
+            for (std::size_t i = 0; i < inner->size; ++i) {
+                res += count_level(inner->data[i].second, level - 1);
+            }
+        }
+        auto & stats = levels[level];
+        stats.smallest = stats.nodes == 0 ? res : std::min(stats.smallest, res);
+        stats.largest = std::max(stats.largest, res);
+        stats.nodes++;
+        return res;
+    }
+
+    // Walks the leaves from slot from of leaf on, up to hi if given
+    template <class F>
+    std::size_t erase_where(Leaf<Key, Value, Less> * leaf, std::size_t from, const Key * hi, F & pred)
+    {
+        using leaf_type = Leaf<Key, Value, Less>;
+        std::size_t res = 0;
+        while (leaf != nullptr) {
+            std::size_t to = leaf->size;
+            const bool last = hi != nullptr && to > 0 && !(leaf->data[to - 1].first < *hi);
+            if (last) {
+                to = leaf->position(*hi, from);
+            }
+            std::size_t kept = from;
+            bool new_min = false;
+            for (std::size_t i = from; i < to; ++i) {
+                if (pred(slot::get(std::as_const(leaf->data[i])))) {
+                    values.destroy(leaf->data[i]);
+                    new_min = new_min || i == 0;
+                    continue;
+                }
+                if (kept != i) {
+                    leaf->data[kept] = std::move(leaf->data[i]);
+                }
+                kept++;
+            }
+            const std::size_t erased = to - kept;
+            if (erased > 0) {
+                std::move(leaf->data.begin() + to, leaf->data.begin() + leaf->size, leaf->data.begin() + kept);
+                leaf->size -= erased;
+                res += erased;
+                if (new_min && leaf->size > 0) {
+                    update_separator(leaf);
+                }
+            }
+            leaf_type * next = last ? nullptr : leaf->right;
+            if (leaf->parent != nullptr && (next == nullptr || next->parent != leaf->parent)) {
+                fix_children(leaf->parent);
+            }
+            leaf = next;
+            from = 0;
+        }
+        size_value -= std::min(size_value, res);
+        if (filter != nullptr) {
+            for (std::size_t i = 0; i < res; ++i) {
+                filter->erased();
+            }
+            if (filter->stale()) {
+                rebuild_filter();
+            }
+        }
+        return res;
+    }
+
+    // Drops the empty leaves among the children of parent, evens out underfull neighbours and
+    // repairs parent
+    void fix_children(Inner_node<Key, Value, Less> * parent)
+    {
+        using leaf_type = Leaf<Key, Value, Less>;
+        const auto * first = parent->data[0].second;
+        leaf_type * prev = nullptr;
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < parent->size; ++i) {
+            auto * child = static_cast<leaf_type *>(parent->data[i].second);
+            if (child->size > 0) {
+                parent->data[kept++] = parent->data[i];
+                prev = child;
+                continue;
+            }
+            if (kept == 0 && prev == nullptr) {
+                prev = left_leaf(parent);
+            }
+            if (prev != nullptr) {
+                prev->right = child->right;
+            }
+            else {
+                first_leaf = child->right;
+            }
+            retire(child);
+        }
+        parent->size = kept;
+        if (kept == 0) {
+            drop_empty(parent);
+            return;
+        }
+        if (parent->data[0].second != first) {
+            update_separator(parent->data[0].second);
+        }
+        for (std::size_t i = 0; i + 1 < parent->size;) {
+            if (!underfull(parent->data[i].second) && !underfull(parent->data[i + 1].second)) {
+                ++i;
+            }
+            else if (auto * removed = parent->balance(i)) {
+                retire(removed);
+            }
+            else {
+                ++i;
+            }
+        }
+        repair(parent);
+        collapse_root();
+    }
+
+    // Unlinks an empty inner node and every ancestor it leaves empty, then repairs the first
+    // ancestor that is not empty
+    void drop_empty(Inner_node<Key, Value, Less> * node)
+    {
+        while (node != root && node->size == 0) {
+            auto * parent = node->parent;
+            const std::size_t k = parent->index_of(node);
+            parent->remove(k);
+            retire(node);
+            if (k == 0 && parent->size > 0) {
+                update_separator(parent->data[0].second);
+            }
+            node = parent;
+        }
+        if (node != root) {
+            repair(node);
+        }
+        collapse_root();
+    }
+
+    // Leaf left of the subtree of the first child of parent, nullptr at the left edge of the tree
+    static Leaf<Key, Value, Less> * left_leaf(Inner_node<Key, Value, Less> * parent)
+    {
+        Node<Key, Value, Less> * node = parent;
+        for (auto * above = parent->parent; above != nullptr; node = above, above = above->parent) {
+            const std::size_t k = above->index_of(node);
+            if (k > 0) {
+                node = above->data[k - 1].second;
+                while (auto * inner = dynamic_cast<Inner_node<Key, Value, Less> *>(node)) {
+                    node = inner->data[inner->size - 1].second;
+                }
+                return static_cast<Leaf<Key, Value, Less> *>(node);
+            }
+        }
+        return nullptr;
+    }
+
+    // Bulk builds a tree of n elements the way from_sorted does, next makes the slot of the
+    // following element in key order
+    template <class F>
+    static BPTree build_sorted(const std::size_t n, const Allocator & allocator, F && next)
+    {
+        using leaf_type = Leaf<Key, Value, Less>;
+        using inner_type = Inner_node<Key, Value, Less>;
+        BPTree res(allocator);
+        if (n == 0) {
+            return res;
+        }
+        // sizes of count nodes sharing n items, none above cap
+        const auto spread = [](const std::size_t n, const std::size_t cap, auto && make) {
+            const std::size_t count = (n + cap - 1) / cap;
+            for (std::size_t i = 0; i < count; ++i) {
+                make(n / count + (i < n % count ? 1 : 0));
+            }
+        };
+        std::vector<leaf_type *> leaves;
+        spread(n, leaf_type::max_size - 1, [&](const std::size_t size) {
+            auto * leaf = leaves.empty() ? res.first_leaf : new (near_hint{leaves.back()}) leaf_type;
+            for (std::size_t i = 0; i < size; ++i) {
+                leaf->data[i] = next(res);
+            }
+            leaf->size = size;
+            if (!leaves.empty()) {
+                leaves.back()->right = leaf;
+            }
+            leaves.push_back(leaf);
+        });
+        const auto build_level = [&spread](const auto & children) {
+            std::vector<inner_type *> res;
+            auto child = children.begin();
+            spread(children.size(), inner_type::max_size - 1, [&](const std::size_t size) {
+                auto * inner = new (near_hint{*child}) inner_type;
+                for (std::size_t i = 0; i < size; ++i, ++child) {
+                    inner->data[i] = std::pair<Key, Node<Key, Value, Less> *>((*child)->data[0].first, *child);
+                    (*child)->new_parent(inner);
+                }
+                inner->size = size;
+                res.push_back(inner);
+            });
+            return res;
+        };
+        res.size_value = n;
+        if (leaves.size() == 1) {
+            return res;
+        }
+        auto level = build_level(leaves);
+        while (level.size() > 1) {
+            level = build_level(level);
+        }
+        res.root = level.front();
+        return res;
+    }
+
+
+    BPTree build_from(const std::vector<const slot_type *> & items) const
+    {
+        return build_sorted(items.size(), get_allocator(), [i = items.begin()](BPTree & res) mutable {
+            const auto item = slot::get(**i++);
+            return res.make_slot(item.first, item.second);
+        });
+    }
+
+    // Position in the leaf chain of a tree, for walking two trees in lockstep
+    class leaf_cursor
+    {
+    public:
+        explicit leaf_cursor(const BPTree & tree)
+            : root(tree.root)
+            , leaf(tree.first_leaf)
+        {
+            settle();
+        }
+
+        bool valid() const
+        {
+            return leaf != nullptr;
+        }
+
+        const Key & key() const
+        {
+            return leaf->data[pos].first;
+        }
+
+        const slot_type & item() const
+        {
+            return leaf->data[pos];
+        }
+
+        void next()
+        {
+            pos++;
+            settle();
+        }
+
+        // Moves to the first element not less than key: searches the rest of the leaf, then the
+        // next one, and only descends from the root when key is past both
+        void seek(const Key & key)
+        {
+            if (!(leaf->data[leaf->size - 1].first < key)) {
+                pos = leaf->position(key, pos);
+                return;
+            }
+            const auto * right = leaf->right;
+            if (right != nullptr && right->size > 0 && !(right->data[right->size - 1].first < key)) {
+                leaf = right;
+                pos = right->position(key);
+                return;
+            }
+            const auto found = root->lower(key);
+            leaf = static_cast<const Leaf<Key, Value, Less> *>(&found.first);
+            pos = found.second;
+            settle();
+        }
+
+    private:
+        // Skips past the end of the leaf and over empty leaves
+        void settle()
+        {
+            while (leaf != nullptr && pos >= leaf->size) {
+                leaf = leaf->right;
+                pos = 0;
+            }
+        }
+
+        Node<Key, Value, Less> * root;
+        const Leaf<Key, Value, Less> * leaf;
+        std::size_t pos = 0;
+    };
+
+    // Exchanges the elements of two trees, unlike swap each tree keeps its allocator and its
+    // settings: filter, hot cache and preemptive mode
+    void swap_contents(BPTree & tree) noexcept
+    {
+        values.swap(tree.values);
+        values.use(memory);
+        tree.values.use(tree.memory);
+        std::swap(size_value, tree.size_value);
+        std::swap(size_stale, tree.size_stale);
+        std::swap(root, tree.root);
+        std::swap(first_leaf, tree.first_leaf);
+        levels.swap(tree.levels);
+        std::swap(levels_size, tree.levels_size);
+    }
+
+    // Brings the filters and hot caches of both trees up to date once join moved the elements of
+    // tree to this one
+    void joined(BPTree & tree)
+    {
+        if (filter != nullptr && (tree.filter == nullptr || !filter->merge(*tree.filter))) {
+            rebuild_filter();
+        }
+        if (tree.filter != nullptr) {
+            tree.rebuild_filter();
+        }
+        if (tree.hot != nullptr) {
+            tree.hot->invalidate();
+        }
+    }
+
+    // Elements of both trees in key order, the ones of first on equal keys
+    static void unite(const BPTree & first, const BPTree & second, std::vector<const slot_type *> & items)
+    {
+        items.reserve(first.size() + second.size());
+        leaf_cursor lhs(first);
+        leaf_cursor rhs(second);
+        while (lhs.valid() || rhs.valid()) {
+            if (!rhs.valid() || (lhs.valid() && lhs.key() < rhs.key())) {
+                items.push_back(&lhs.item());
+                lhs.next();
+            }
+            else if (!lhs.valid() || rhs.key() < lhs.key()) {
+                items.push_back(&rhs.item());
+                rhs.next();
+            }
+            else {
+                items.push_back(&lhs.item());
+                lhs.next();
+                rhs.next();
+            }
+        }
+    }
+
+    struct level_stats
+    {
+        std::size_t nodes = 0;
+        // elements below the smallest and the largest node of the level
+        std::size_t smallest = 0;
+        std::size_t largest = 0;
+    };
+
+    // Leaves of a cloned subtree, linked in key order
+    struct leaf_chain
+    {
+        Leaf<Key, Value, Less> * first = nullptr;
+        Leaf<Key, Value, Less> * last = nullptr;
+
+        void append(Leaf<Key, Value, Less> * leaf)
+        {
+            if (last != nullptr) {
+                last->right = leaf;
+            }
+            else {
+                first = leaf;
+            }
+            last = leaf;
+        }
+
+        void append(const leaf_chain & chain)
+        {
+            if (chain.first != nullptr) {
+                append(chain.first);
+                last = chain.last;
+            }
+        }
+    };
+
+    template <class K, class V>
+    slot_type make_slot(K && key, V && value)
+    {
+        return make_slot(values, std::forward<K>(key), std::forward<V>(value));
+    }
+
+    template <class K, class V>
+    slot_type make_slot(Value_arena<Key, Value> & arena, K && key, V && value) const
+    {
+        if constexpr (allocator_aware) {
+            return arena.make_slot(with_allocator<Key>(std::forward<K>(key)), with_allocator<Value>(std::forward<V>(value)));
+        }
+        else {
+            return arena.make_slot(std::forward<K>(key), std::forward<V>(value));
+        }
+    }
+
+    // New node of this tree, next to another one of it if given
+    template <class T>
+    T * new_node(const Node<Key, Value, Less> * near) const
+    {
+        return near != nullptr ? new (near_hint{near}) T : new (node_resource{memory}) T;
+    }
+
+    // Copies the nodes of tree into this empty tree level by level: O(n) without a single split,
+    // slots are copied as they are and the leaves are linked as they are made. Subtrees of the
+    // root are cloned in parallel when the tree is big and nodes come from the global heap, a
+    // memory resource need not take concurrent allocations. This tree stays empty if copying throws
+    void clone_from(const BPTree & tree)
+    {
+        using inner_type = Inner_node<Key, Value, Less>;
+        std::size_t height = 0;
+        const Node<Key, Value, Less> * node = tree.root;
+        while (const auto * inner = dynamic_cast<const inner_type *>(node)) {
+            node = inner->data[0].second;
+            height++;
+        }
+        std::size_t workers = 1;
+        if (height > 0 && memory == nullptr && tree.size() >= parallel_clone_min) {
+            workers = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u), static_cast<const inner_type *>(tree.root)->size);
+        }
+        leaf_chain chain;
+        auto * copy = workers > 1 ? clone_parallel(static_cast<const inner_type &>(*tree.root), height, workers, chain)
+                                  : clone_node(tree.root, height, nullptr, values, chain);
+        delete root;
+        root = copy;
+        first_leaf = chain.first;
+        size_value = tree.size_value;
+        size_stale = tree.size_stale;
+        if (tree.filter != nullptr) {
+            filter = std::make_unique<Key_filter<Key>>(*tree.filter);
+        }
+        hot.reset();
+        if (tree.hot != nullptr) {
+            hot = std::make_unique<Hot_cache<Key, Value, Less>>(tree.hot->capacity());
+        }
+    }
+
+    // Copy of a subtree whose leaves are height levels down, its values are made in arena
+    Node<Key, Value, Less> * clone_node(const Node<Key, Value, Less> * node, const std::size_t height, const Node<Key, Value, Less> * near, Value_arena<Key, Value> & arena, leaf_chain & chain) const
+    {
+        using leaf_type = Leaf<Key, Value, Less>;
+        using inner_type = Inner_node<Key, Value, Less>;
+        if (height == 0) {
+            const auto & from = static_cast<const leaf_type &>(*node);
+            auto * leaf = new_node<leaf_type>(near);
+            try {
+                if constexpr (slot::out_of_line) {
+                    for (; leaf->size < from.size; leaf->size++) {
+                        const auto & item = from.data[leaf->size];
+                        leaf->data[leaf->size] = make_slot(arena, item.first, *item.second);
+                    }
+                }
+                else {
+                    std::copy(from.data.begin(), from.data.begin() + from.size, leaf->data.begin());
+                    leaf->size = from.size;
+                }
+            }
+            catch (...) {
+                drop(leaf, 0, arena);
+                throw;
+            }
+            chain.append(leaf);
+            return leaf;
+        }
+        const auto & from = static_cast<const inner_type &>(*node);
+        auto * inner = new_node<inner_type>(near);
+        try {
+            for (; inner->size < from.size; inner->size++) {
+                auto & item = inner->data[inner->size];
+                item.first = from.data[inner->size].first;
+                item.second = clone_node(from.data[inner->size].second, height - 1, inner, arena, chain);
+                item.second->new_parent(inner);
+            }
+        }
+        catch (...) {
+            drop(inner, height, arena);
+            throw;
+        }
+        return inner;
+    }
+
+    // Clones the children of the root on a pool of threads: each worker takes the next subtree
+    // nobody has taken yet and makes its values in an arena of its own
+    Node<Key, Value, Less> * clone_parallel(const Inner_node<Key, Value, Less> & from, const std::size_t height, const std::size_t workers, leaf_chain & chain)
+    {
+        using inner_type = Inner_node<Key, Value, Less>;
+        auto * top = new_node<inner_type>(nullptr);
+        std::vector<Node<Key, Value, Less> *> children(from.size, nullptr);
+        std::vector<leaf_chain> chains(from.size);
+        std::vector<Value_arena<Key, Value>> arenas(workers);
+        std::vector<std::exception_ptr> errors(workers);
+        std::atomic<std::size_t> next{0};
+        const auto work = [&](const std::size_t w) {
+            try {
+                for (std::size_t k = next++; k < from.size; k = next++) {
+                    children[k] = clone_node(from.data[k].second, height - 1, top, arenas[w], chains[k]);
+                }
+            }
+            catch (...) {
+                errors[w] = std::current_exception();
+                next = from.size;
+            }
+        };
+        std::vector<std::thread> pool;
+        try {
+            for (std::size_t w = 1; w < workers; ++w) {
+                pool.emplace_back(work, w);
+            }
+        }
+        catch (const std::system_error &) {
+            // the workers already started take over the rest
+        }
+        work(0);
+        for (auto & thread : pool) {
+            thread.join();
+        }
+        for (auto & arena : arenas) {
+            values.adopt(arena);
+        }
+        try {
+            for (const auto & error : errors) {
+                if (error != nullptr) {
+                    std::rethrow_exception(error);
+                }
+            }
+            for (; top->size < from.size; top->size++) {
+                const std::size_t k = top->size;
+                top->data[k].first = from.data[k].first;
+                top->data[k].second = children[k];
+                children[k]->new_parent(top);
+                children[k] = nullptr;
+                chain.append(chains[k]);
+            }
+        }
+        catch (...) {
+            for (auto * child : children) {
+                if (child != nullptr) {
+                    drop(child, height - 1, values);
+                }
+            }
+            drop(top, height, values);
+            throw;
+        }
+        return top;
+    }
+
+    // Frees a subtree that never made it into a tree together with its values
+    static void drop(Node<Key, Value, Less> * node, const std::size_t height, Value_arena<Key, Value> & arena)
+    {
+        if (height == 0) {
+            if constexpr (slot::out_of_line) {
+                auto * leaf = static_cast<Leaf<Key, Value, Less> *>(node);
+                for (std::size_t i = 0; i < leaf->size; ++i) {
+                    arena.destroy(leaf->data[i]);
+                }
+            }
+        }
+        else {
+            auto * inner = static_cast<Inner_node<Key, Value, Less> *>(node);
+            for (std::size_t i = 0; i < inner->size; ++i) {
+                drop(inner->data[i].second, height - 1, arena);
+            }
+        }
+        delete node;
+    }
+
+    static constexpr std::size_t lookup_batch = 16;
+    static constexpr std::size_t reclaim_batch = 64;
+    // trees smaller than this are cloned on the calling thread only
+    static constexpr std::size_t parallel_clone_min = std::size_t(1) << 16;
+
+    static bool matches(const Key & key, const Leaf<Key, Value, Less> & leaf, const std::size_t pos)
+    {
+        return pos < leaf.size && leaf.data[pos].first == key;
+    }
+
+    // Calls f with every non-empty leaf from the one of lo on and the first slot to visit in it,
+    // until f returns false
+    template <class F>
+    void scan_leaves(const Key & lo, F && f) const
+    {
+        const auto start = root->lower(lo);
+        std::size_t from = start.second;
+        for (const auto * leaf = static_cast<const Leaf<Key, Value, Less> *>(&start.first); leaf != nullptr; leaf = leaf->right, from = 0) {
+            if (from < leaf->size && !f(leaf, from)) {
+                return;
+            }
+        }
+    }
+
+    static bool underfull(Node<Key, Value, Less> * node)
+    {
+        if (auto * leaf = dynamic_cast<Leaf<Key, Value, Less> *>(node)) {
+            return leaf->size < Leaf<Key, Value, Less>::max_size / 2;
+        }
+        return static_cast<Inner_node<Key, Value, Less> *>(node)->size < Inner_node<Key, Value, Less>::max_size / 2;
+    }
+
+    static bool empty_node(Node<Key, Value, Less> * node)
+    {
+        if (auto * leaf = dynamic_cast<Leaf<Key, Value, Less> *>(node)) {
+            return leaf->size == 0;
+        }
+        return static_cast<Inner_node<Key, Value, Less> *>(node)->size == 0;
+    }
+
+    Leaf<Key, Value, Less> * leftmost_leaf() const
+    {
+        auto * node = root;
+        while (auto * inner = dynamic_cast<Inner_node<Key, Value, Less> *>(node)) {
+            node = inner->data[0].second;
+        }
+        return static_cast<Leaf<Key, Value, Less> *>(node);
+    }
+
+    Leaf<Key, Value, Less> * last_leaf() const
+    {
+        auto * node = root;
+        while (auto * inner = dynamic_cast<Inner_node<Key, Value, Less> *>(node)) {
+            node = inner->data[inner->size - 1].second;
+        }
+        return static_cast<Leaf<Key, Value, Less> *>(node);
+    }
+
+    // Removes slot pos of the leaf and restores the invariants bottom-up: the first separators
+    // of the ancestors are kept equal to the minimum of their subtree and every underfull node
+    // is evened out with a sibling, merging the two when they fit into one node
+    iterator erase_at(Leaf<Key, Value, Less> * leaf, const std::size_t pos)
+    {
+        const bool last = pos + 1 == leaf->size && leaf->right == nullptr;
+        std::optional<Key> next;
+        if (!last) {
+            next = pos + 1 < leaf->size ? leaf->data[pos + 1].first : leaf->right->data[0].first;
+        }
+        values.destroy(leaf->data[pos]);
+        leaf->erase(pos);
+        if (size_value > 0) {
+            size_value--;
+        }
+        if (filter != nullptr) {
+            filter->erased();
+        }
+        if (pos == 0 && leaf->size > 0) {
+            update_separator(leaf);
+        }
+        const bool restructured = repair(leaf);
+        if (last) {
+            return end();
+        }
+        return restructured ? lower_bound(*next) : iterator(*leaf, pos);
+    }
+
+    // Evens out an underfull node and then every underfull ancestor with a sibling, returns
+    // whether the tree was restructured
+    bool repair(Node<Key, Value, Less> * node)
+    {
+        bool restructured = false;
+        while (node != root && underfull(node)) {
+            auto * parent = parent_of(node);
+            if (parent->size > 1) {
+                const std::size_t k = parent->index_of(node);
+                const std::size_t left = k > 0 ? k - 1 : 0;
+                if (auto * removed = parent->balance(left)) {
+                    retire(removed);
+                }
+                if (left == 0) {
+                    update_separator(parent->data[0].second);
+                }
+                restructured = true;
+            }
+            node = parent;
+        }
+        if (restructured) {
+            collapse_root();
+        }
+        return restructured;
+    }
+
+    // Applies messages sorted by key, one per key. The messages are grouped by the leaf whose
+    // range contains them and each group is applied with one descent and one pass over the leaf:
+    // erased slots are compacted out and the new keys merged in, its ancestors are repaired once
+    template <class It>
+    void apply_sorted(It first, const It last)
+    {
+        using leaf_type = Leaf<Key, Value, Less>;
+        using kind = typename Message_buffer<Key, Value>::Kind;
+        if (first == last) {
+            return;
+        }
+        std::vector<slot_type> slots;
+        while (first != last) {
+            std::optional<Key> upper;
+            auto * leaf = root->leaf_of(first->key, upper);
+            const auto end = !upper
+                    ? last
+                    : std::lower_bound(first, last, *upper, [](const auto & lhs, const auto & rhs) {
+                          return lhs.key < rhs;
+                      });
+            const std::optional<Key> old_min = leaf->size > 0 ? std::optional<Key>(leaf->data[0].first) : std::nullopt;
+            // slots before pos have been read, the ones kept of them are packed before kept
+            slots.clear();
+            std::size_t kept = 0;
+            std::size_t pos = 0;
+            const auto keep = [&](const std::size_t to) {
+                if (kept != pos) {
+                    std::move(leaf->data.begin() + pos, leaf->data.begin() + to, leaf->data.begin() + kept);
+                }
+                kept += to - pos;
+                pos = to;
+            };
+            for (; first != end; ++first) {
+                keep(leaf->position(first->key, pos));
+                if (!matches(first->key, *leaf, pos)) {
+                    if (first->kind != kind::erase) {
+                        slots.push_back(make_slot(first->key, std::move(*first->value)));
+                    }
+                }
+                else if (first->kind == kind::erase) {
+                    values.destroy(leaf->data[pos]);
+                    if (filter != nullptr) {
+                        filter->erased();
+                    }
+                    pos++;
+                }
+                else {
+                    if (first->kind == kind::assign) {
+                        (*leaf)[pos].second = std::move(*first->value);
+                    }
+                    keep(pos + 1);
+                }
+            }
+            keep(leaf->size);
+            size_value -= std::min(size_value, leaf->size - kept);
+            leaf->size = kept;
+            // the new keys that fit are merged, the rest is inserted one by one once the
+            // separators are exact again
+            const std::size_t fit = std::min(slots.size(), leaf_type::max_size - 1 - kept);
+            if (filter != nullptr) {
+                std::for_each(slots.begin(), slots.begin() + fit, [this](const auto & slot) {
+                    filter->add(slot.first);
+                });
+            }
+            leaf->merge_sorted(slots.begin(), slots.begin() + fit);
+            size_value += fit;
+            if (kept + fit > 0 && (!old_min || !(leaf->data[0].first == *old_min))) {
+                update_separator(leaf);
+            }
+            auto * target = leaf;
+            for (auto i = slots.begin() + fit; i != slots.end(); ++i) {
+                while (leaf->right != nullptr && !(i->first < leaf->right->data[0].first)) {
+                    leaf = leaf->right;
+                }
+                inserted(leaf->insert_move(root, std::move(*i)), *i);
+            }
+            if (target->size < leaf_type::max_size / 2) {
+                repair(target);
+            }
+            if (filter != nullptr && filter->stale()) {
+                rebuild_filter();
+            }
+        }
+    }
+
+    // Sizes a new filter for twice the current number of keys
+    void rebuild_filter()
+    {
+        filter = std::make_unique<Key_filter<Key>>(2 * size());
+        for (auto * leaf = first_leaf; leaf != nullptr; leaf = leaf->right) {
+            for (std::size_t i = 0; i < leaf->size; ++i) {
+                filter->add(leaf->data[i].first);
+            }
+        }
+    }
+
+    Node<Key, Value, Less> * insert_target(const Key & key)
+    {
+        return preemptive_mode ? split_path(key) : root;
+    }
+
+    // Splits every full inner node on the path of key before descending into it, the split of the
+    // leaf is then absorbed by its parent. Returns the leaf of key
+    Leaf<Key, Value, Less> * split_path(const Key & key)
+    {
+        using inner_type = Inner_node<Key, Value, Less>;
+        const auto full = [](Node<Key, Value, Less> * node) {
+            auto * inner = dynamic_cast<inner_type *>(node);
+            return inner != nullptr && inner->size + 1 == inner_type::max_size;
+        };
+        if (full(root)) {
+            root = root->split(root);
+        }
+        auto * node = root;
+        while (auto * inner = dynamic_cast<inner_type *>(node)) {
+            node = inner->data[inner->child_index(key)].second;
+            if (full(node)) {
+                root = node->split(root);
+                node = inner->data[inner->child_index(key)].second;
+            }
+        }
+        return static_cast<Leaf<Key, Value, Less> *>(node);
+    }
+
+    // Evens out every minimal node on the path of key with its larger neighbour before descending
+    // into it. Returns the leaf of key
+    Leaf<Key, Value, Less> * merge_path(const Key & key)
+    {
+        using inner_type = Inner_node<Key, Value, Less>;
+        const auto minimal = [](Node<Key, Value, Less> * node) {
+            if (auto * leaf = dynamic_cast<Leaf<Key, Value, Less> *>(node)) {
+                return leaf->size <= Leaf<Key, Value, Less>::max_size / 2;
+            }
+            return static_cast<inner_type *>(node)->size <= inner_type::max_size / 2;
+        };
+        const auto size_of = [](Node<Key, Value, Less> * node) {
+            if (auto * leaf = dynamic_cast<Leaf<Key, Value, Less> *>(node)) {
+                return leaf->size;
+            }
+            return static_cast<inner_type *>(node)->size;
+        };
+        auto * node = root;
+        while (auto * inner = dynamic_cast<inner_type *>(node)) {
+            std::size_t k = inner->child_index(key);
+            if (inner->size > 1 && minimal(inner->data[k].second)) {
+                const bool right = k == 0 || (k + 1 < inner->size && size_of(inner->data[k + 1].second) > size_of(inner->data[k - 1].second));
+                retire(inner->balance(right ? k : k - 1));
+                if (inner == root && inner->size == 1) {
+                    collapse_root();
+                    node = root;
+                    continue;
+                }
+                k = inner->child_index(key);
+            }
+            node = inner->data[k].second;
+        }
+        return static_cast<Leaf<Key, Value, Less> *>(node);
+    }
+
+    // Unlinked nodes are freed in batches, once the readers of their epoch have unpinned. The
+    // next attempt waits until the list has doubled, so long-pinned readers do not make every
+    // retire rescan it
+    void retire(Node<Key, Value, Less> * node)
+    {
+        if (hot != nullptr && dynamic_cast<Leaf<Key, Value, Less> *>(node) != nullptr) {
+            hot->invalidate();
+        }
+        retired.retire(node, epoch());
+        if (retired.size() >= reclaim_at) {
+            reclaim();
+            reclaim_at = std::max(reclaim_batch, 2 * retired.size());
+        }
+    }
+
+    // Epoch manager of the pinned readers, made by the first pin: a tree nobody pins does without
+    // its reader slots
+    Epoch_manager & readers() const
+    {
+        Epoch_manager * res = epochs.load();
+        if (res == nullptr) {
+            auto made = std::make_unique<Epoch_manager>();
+            if (epochs.compare_exchange_strong(res, made.get())) {
+                res = made.release();
+            }
+        }
+        return *res;
+    }
+
+    std::uint64_t epoch() const
+    {
+        const Epoch_manager * manager = epochs.load();
+        return manager != nullptr ? manager->current() : 0;
+    }
+
+    // Frees the retired nodes no pinned reader can reach any more, all of them if nobody ever pinned
+    void reclaim()
+    {
+        Epoch_manager * manager = epochs.load();
+        if (manager == nullptr) {
+            retired.clear();
+            return;
+        }
+        manager->advance();
+        retired.reclaim(manager->safe());
+    }
+
+    // Visits the nodes of a subtree children first
+    template <class F>
+    static void for_each_node(Node<Key, Value, Less> * node, F && f)
+    {
+        if (auto * inner = dynamic_cast<Inner_node<Key, Value, Less> *>(node)) {
+            for (std::size_t i = 0; i < inner->size; ++i) {
+                for_each_node(inner->data[i].second, f);
+            }
+        }
+        f(node);
+    }
+
+    static Inner_node<Key, Value, Less> * parent_of(Node<Key, Value, Less> * node)
+    {
+        if (auto * leaf = dynamic_cast<Leaf<Key, Value, Less> *>(node)) {
+            return leaf->parent;
+        }
+        return static_cast<Inner_node<Key, Value, Less> *>(node)->parent;
+    }
+
+    // Propagates the smallest key of a non-empty node to the separators above it
+    static void update_separator(Node<Key, Value, Less> * node)
+    {
+        const Key & key = dynamic_cast<Leaf<Key, Value, Less> *>(node) != nullptr
+                ? static_cast<Leaf<Key, Value, Less> *>(node)->data[0].first
+                : static_cast<Inner_node<Key, Value, Less> *>(node)->data[0].first;
+        for (auto * parent = parent_of(node); parent != nullptr; node = parent, parent = parent_of(node)) {
+            const std::size_t k = parent->index_of(node);
+            if (k != 0) {
+                lift_messages(parent, node, key);
+            }
+            parent->data[k].first = key;
+            if (k != 0) {
+                break;
+            }
+        }
+    }
+
+    // Raising the separator of a child moves the keys below the new one to its left sibling, so
+    // messages buffered for them along the left spine of the child are moved up to the parent
+    static void lift_messages(Inner_node<Key, Value, Less> * parent, Node<Key, Value, Less> * node, const Key & key)
+    {
+        while (auto * inner = dynamic_cast<Inner_node<Key, Value, Less> *>(node)) {
+            if (inner->buffer != nullptr && !inner->buffer->empty()) {
+                if (parent->buffer == nullptr) {
+                    parent->buffer = std::make_unique<Message_buffer<Key, Value>>();
+                }
+                for (auto & item : inner->buffer->take(std::nullopt, key)) {
+                    parent->buffer->add_older(std::move(item));
+                }
+            }
+            node = inner->data[0].second;
+        }
+    }
+
+    // Repairs the leftmost or the rightmost root-to-leaf path after it was cut or grafted onto:
+    // drops empty nodes and evens out underfull ones with their inner siblings, deepest first
+    void fix_spine(const bool left)
+    {
+        using inner_type = Inner_node<Key, Value, Less>;
+        std::vector<inner_type *> path;
+        for (bool changed = true; changed;) {
+            changed = false;
+            path.clear();
+            Node<Key, Value, Less> * node = root;
+            while (auto * inner = dynamic_cast<inner_type *>(node)) {
+                path.push_back(inner);
+                node = inner->size == 0 ? nullptr : inner->data[left ? 0 : inner->size - 1].second;
+            }
+            for (auto i = path.rbegin(); i != path.rend() && !changed; ++i) {
+                auto * parent = *i;
+                if (parent->size == 0) {
+                    continue;
+                }
+                const std::size_t k = left ? 0 : parent->size - 1;
+                node = parent->data[k].second;
+                if (empty_node(node)) {
+                    parent->remove(k);
+                    retire(node);
+                    changed = true;
+                }
+                else if (underfull(node) && parent->size > 1) {
+                    retire(parent->balance(left ? 0 : k - 1));
+                    changed = true;
+                }
+            }
+        }
+        collapse_root();
+    }
+
+    void collapse_root()
+    {
+        while (auto * inner = dynamic_cast<Inner_node<Key, Value, Less> *>(root)) {
+            if (inner->size > 1) {
+                break;
+            }
+            if (inner->size == 1 && inner->buffer != nullptr && !inner->buffer->empty()) {
+                // pending updates of a root in buffered mode go down to the only child
+                auto * child = dynamic_cast<Inner_node<Key, Value, Less> *>(inner->data[0].second);
+                if (child == nullptr) {
+                    break;
+                }
+                if (child->buffer == nullptr) {
+                    child->buffer = std::make_unique<Message_buffer<Key, Value>>();
+                }
+                child->buffer->add(std::move(*inner->buffer));
+            }
+            root = inner->size == 0 ? new (node_resource{memory}) Leaf<Key, Value, Less>() : inner->data[0].second;
+            root->new_parent(nullptr);
+            retire(inner);
+        }
+        first_leaf = leftmost_leaf();
+        last_leaf()->right = nullptr;
+        // first separators along the left spine are kept equal to the smallest key
+        if (first_leaf->size > 0) {
+            auto * node = root;
+            while (auto * inner = dynamic_cast<Inner_node<Key, Value, Less> *>(node)) {
+                inner->data[0].first = first_leaf->data[0].first;
+                node = inner->data[0].second;
+            }
+        }
+    }
+
+    std::size_t height() const
+    {
+        std::size_t res = 0;
+        for (auto * node = root; dynamic_cast<Inner_node<Key, Value, Less> *>(node) != nullptr; ++res) {
+            node = static_cast<Inner_node<Key, Value, Less> *>(node)->data[0].second;
+        }
+        return res;
+    }
+
+    template <class It, class F>
+    void descend_many(It first, const It last, F && visit) const
+    {
+        using inner_type = Inner_node<Key, Value, Less>;
+        using leaf_type = Leaf<Key, Value, Less>;
+        const std::size_t levels = height();
+        const bool sorted = std::is_sorted(first, last);
+        std::array<Node<Key, Value, Less> *, lookup_batch> nodes;
+        std::array<std::size_t, lookup_batch> slots;
+        while (first != last) {
+            const auto n = static_cast<std::size_t>(std::min<std::ptrdiff_t>(lookup_batch, std::distance(first, last)));
+            nodes.fill(root);
+            for (std::size_t level = 0; level < levels; ++level) {
+                const bool leaves_next = level + 1 == levels;
+                const inner_type * prev = nullptr;
+                for (std::size_t j = 0; j < n; ++j) {
+                    const auto * inner = static_cast<const inner_type *>(nodes[j]);
+                    const bool shared = sorted && inner == prev;
+                    prev = inner;
+                    slots[j] = inner->child_index(first[j], shared ? slots[j - 1] : 0);
+                    nodes[j] = inner->data[slots[j]].second;
+                    if (shared && nodes[j] == nodes[j - 1]) {
+                        continue;
+                    }
+                    if (leaves_next) {
+                        leaf_type::prefetch(nodes[j]);
+                    }
+                    else {
+                        inner_type::prefetch(nodes[j]);
+                    }
+                }
+            }
+            const leaf_type * prev = nullptr;
+            for (std::size_t j = 0; j < n; ++j) {
+                auto * leaf = static_cast<leaf_type *>(nodes[j]);
+                const bool shared = sorted && leaf == prev;
+                slots[j] = leaf->position(first[j], shared ? slots[j - 1] : 0);
+                visit(first[j], *leaf, slots[j]);
+                prev = leaf;
+            }
+            first += n;
+        }
+    }
+
+    std::pair<iterator, bool> inserted(const std::tuple<Node<Key, Value, Less> *, Node<Key, Value, Less> &, std::size_t, bool> & res, const slot_type & slot)
+    {
+        root = std::get<0>(res);
+        if (std::get<3>(res)) {
+            size_value++;
+            if (filter != nullptr) {
+                // slot may have been moved into the leaf
+                filter->add(static_cast<Leaf<Key, Value, Less> &>(std::get<1>(res)).data[std::get<2>(res)].first);
+                if (filter->stale()) {
+                    rebuild_filter();
+                }
+            }
+        }
+        else {
+            values.discard(slot);
+        }
+        return std::pair<iterator, bool>(iterator(std::get<1>(res), std::get<2>(res)), std::get<3>(res));
+    }
+
+    // memory resource of a polymorphic allocator, nullptr for std::allocator
+    std::pmr::memory_resource * memory;
+    Value_arena<Key, Value> values;
+    mutable size_t size_value;
+    mutable bool size_stale = false;
+    Node<Key, Value, Less> * root;
+    Leaf<Key, Value, Less> * first_leaf;
+    // owned, made by the first pin
+    mutable std::atomic<Epoch_manager *> epochs{nullptr};
+    Retire_list<Node<Key, Value, Less>> retired;
+    std::size_t reclaim_at = reclaim_batch;
+    bool preemptive_mode = false;
+    std::unique_ptr<Key_filter<Key>> filter;
+    // front cache of hot keys, dropped whenever leaves are retired
+    std::unique_ptr<Hot_cache<Key, Value, Less>> hot;
+    // first key of the leaf the next compact call starts at, none at the start of a pass
+    std::optional<Key> compact_from;
+    // statistics of range estimates per level, leaves first, and the size they were taken at
+    mutable std::vector<level_stats> levels;
+    mutable std::size_t levels_size = 0;
+};
+
+namespace pmr
+{
+template <class Key, class Value, class Less = std::less<Key>>
+using BPTree = ::BPTree<Key, Value, Less, std::pmr::polymorphic_allocator<std::pair<const Key, Value>>>;
+}
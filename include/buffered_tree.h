@@ -0,0 +1,325 @@
+#pragma once
+
+#include "bptree.h"
+#include "message_buffer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Write-optimized mode of BPTree in the spirit of a B-epsilon tree: updates are blind messages
+// which are buffered in the inner nodes. When the buffer of a node overflows, its messages move
+// one level down in per-child batches, so a leaf is touched once per batch instead of once per
+// update. Lookups check the buffers along the root-to-leaf path
+template <class Key, class Value, class Less = std::less<Key>>
+class BufferedBPTree
+{
+    using tree_type = BPTree<Key, Value, Less>;
+    using buffer_type = Message_buffer<Key, Value>;
+    using message = typename buffer_type::message;
+    using kind = typename buffer_type::Kind;
+    using node_type = Node<Key, Value, Less>;
+    using inner_type = Inner_node<Key, Value, Less>;
+    using leaf_type = Leaf<Key, Value, Less>;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using size_type = std::size_t;
+
+    // Messages an inner node buffers before they are flushed to its children
+    static constexpr std::size_t buffer_capacity = 8 * inner_type::max_size;
+    // Updates collected in arrival order before they are sorted into the root buffer
+    static constexpr std::size_t staged_capacity = 64;
+
+    BufferedBPTree() = default;
+
+    explicit BufferedBPTree(tree_type && tree)
+        : tree(std::move(tree))
+    {
+    }
+
+    BufferedBPTree(const BufferedBPTree &) = delete;
+
+    BufferedBPTree(BufferedBPTree &&) = default;
+
+    BufferedBPTree & operator=(const BufferedBPTree &) = delete;
+
+    BufferedBPTree & operator=(BufferedBPTree &&) = default;
+
+    // Inserts the value unless the key is present by the time the message reaches its leaf
+    void insert(const Key & key, const Value & value)
+    {
+        push(message{key, kind::insert, value});
+    }
+
+    void insert_or_assign(const Key & key, const Value & value)
+    {
+        push(message{key, kind::assign, value});
+    }
+
+    void erase(const Key & key)
+    {
+        push(message{key, kind::erase, std::nullopt});
+    }
+
+    // Current value of key with all pending updates taken into account, nullptr if it is absent
+    const Value * get(const Key & key) const
+    {
+        const Value * inserted = nullptr;
+        for (auto i = staged.rbegin(); i != staged.rend(); ++i) {
+            if (i->key == key) {
+                if (i->kind != kind::insert) {
+                    return i->kind == kind::assign ? &*i->value : inserted;
+                }
+                inserted = &*i->value;
+            }
+        }
+        const Value * res = get(key, tree.root);
+        return res != nullptr ? res : inserted;
+    }
+
+    bool contains(const Key & key) const
+    {
+        return get(key) != nullptr;
+    }
+
+    // Applies all pending updates to the leaves
+    void flush()
+    {
+        std::vector<std::pair<std::size_t, message>> items;
+        for (auto & item : staged) {
+            items.emplace_back(0, std::move(item));
+        }
+        staged.clear();
+        collect(tree.root, 1, items);
+        if (items.empty()) {
+            return;
+        }
+        // for equal keys the deeper message is the older one, staged ones keep their order
+        std::stable_sort(items.begin(), items.end(), [](const auto & lhs, const auto & rhs) {
+            return lhs.second.key < rhs.second.key || (!(rhs.second.key < lhs.second.key) && lhs.first > rhs.first);
+        });
+        for (auto i = items.begin(); i != items.end();) {
+            auto j = std::next(i);
+            for (; j != items.end() && j->second.key == i->second.key; ++j) {
+                buffer_type::combine(i->second, std::move(j->second));
+            }
+            apply(std::move(i->second));
+            i = j;
+        }
+        tree.collapse_root();
+    }
+
+    // The underlying tree with all pending updates applied
+    tree_type & flushed()
+    {
+        flush();
+        return tree;
+    }
+
+    size_type size()
+    {
+        return flushed().size();
+    }
+
+    // Number of updates which have not reached the leaves yet
+    std::size_t pending() const
+    {
+        std::size_t res = staged.size();
+        visit(tree.root, [&res](const inner_type * inner) {
+            res += inner->buffer != nullptr ? inner->buffer->size() : 0;
+        });
+        return res;
+    }
+
+    void clear()
+    {
+        staged.clear();
+        tree.clear();
+    }
+
+private:
+    void push(message && item)
+    {
+        if (dynamic_cast<inner_type *>(tree.root) == nullptr) {
+            apply(std::move(item));
+            return;
+        }
+        staged.push_back(std::move(item));
+        if (staged.size() == staged_capacity) {
+            flush_staged();
+        }
+    }
+
+    // Sorts the staged updates into the root buffer, folding the ones for the same key
+    void flush_staged()
+    {
+        std::stable_sort(staged.begin(), staged.end(), [](const auto & lhs, const auto & rhs) {
+            return lhs.key < rhs.key;
+        });
+        auto last = staged.begin();
+        for (auto i = std::next(staged.begin()); i != staged.end(); ++i) {
+            if (i->key == last->key) {
+                buffer_type::combine(*last, std::move(*i));
+            }
+            else {
+                *++last = std::move(*i);
+            }
+        }
+        staged.erase(std::next(last), staged.end());
+        auto * root = dynamic_cast<inner_type *>(tree.root);
+        if (root == nullptr) {
+            for (auto & item : staged) {
+                apply(std::move(item));
+            }
+        }
+        else {
+            if (root->buffer == nullptr) {
+                root->buffer = std::make_unique<buffer_type>();
+            }
+            root->buffer->add(std::make_move_iterator(staged.begin()), std::make_move_iterator(staged.end()));
+            flush_node(root);
+        }
+        staged.clear();
+    }
+
+    // Moves all messages of an overflowing buffer one level down, children whose buffers overflow
+    // in turn are flushed afterwards. Messages are sorted, so each child gets a single batch.
+    // Flushing a child may split or merge its siblings and free them, so the overflowing children
+    // are remembered by key and looked up again right before each of them is flushed
+    void flush_node(inner_type * node)
+    {
+        if (node->buffer == nullptr || node->buffer->size() <= buffer_capacity) {
+            return;
+        }
+        auto items = node->buffer->take_all();
+        if (dynamic_cast<leaf_type *>(node->data[0].second) != nullptr) {
+            tree.apply_sorted(items.begin(), items.end());
+            return;
+        }
+        const std::size_t level = level_of(node) - 1;
+        std::vector<Key> overflowing;
+        std::size_t slot = 0;
+        for (auto first = items.begin(); first != items.end();) {
+            slot = node->child_index(first->key, slot);
+            const auto last = slot + 1 == node->size
+                    ? items.end()
+                    : std::lower_bound(first, items.end(), node->data[slot + 1].first, [](const auto & lhs, const auto & rhs) {
+                          return lhs.key < rhs;
+                      });
+            auto * child = static_cast<inner_type *>(node->data[slot].second);
+            if (child->buffer == nullptr) {
+                child->buffer = std::make_unique<buffer_type>();
+            }
+            child->buffer->add(std::make_move_iterator(first), std::make_move_iterator(last));
+            if (child->buffer->size() > buffer_capacity) {
+                overflowing.push_back(node->data[slot].first);
+            }
+            first = last;
+        }
+        for (const Key & key : overflowing) {
+            if (auto * child = node_at(key, level)) {
+                flush_node(child);
+            }
+        }
+    }
+
+    // Inner node on the path of key which is level levels above the leaves, nullptr once the tree
+    // has become lower than that
+    inner_type * node_at(const Key & key, const std::size_t level) const
+    {
+        const std::size_t height = tree.height();
+        if (height < level) {
+            return nullptr;
+        }
+        node_type * node = tree.root;
+        for (std::size_t i = level; i < height; ++i) {
+            auto * inner = static_cast<inner_type *>(node);
+            node = inner->data[inner->child_index(key)].second;
+        }
+        return static_cast<inner_type *>(node);
+    }
+
+    // Number of inner levels from node down to the leaves, node included
+    static std::size_t level_of(const node_type * node)
+    {
+        std::size_t res = 0;
+        for (; dynamic_cast<const inner_type *>(node) != nullptr; ++res) {
+            node = static_cast<const inner_type *>(node)->data[0].second;
+        }
+        return res;
+    }
+
+    void apply(message && item)
+    {
+        switch (item.kind) {
+        case kind::insert:
+            tree.insert(item.key, std::move(*item.value));
+            break;
+        case kind::assign: {
+            auto it = tree.find(item.key);
+            if (it != tree.end()) {
+                it->second = std::move(*item.value);
+            }
+            else {
+                tree.insert(item.key, std::move(*item.value));
+            }
+            break;
+        }
+        case kind::erase:
+            tree.erase(item.key);
+            break;
+        }
+    }
+
+    const Value * get(const Key & key, const node_type * node) const
+    {
+        const auto * inner = dynamic_cast<const inner_type *>(node);
+        if (inner == nullptr) {
+            const auto * leaf = static_cast<const leaf_type *>(node);
+            const std::size_t pos = leaf->position(key);
+            return tree_type::matches(key, *leaf, pos) ? &(*leaf)[pos].second : nullptr;
+        }
+        const message * item = inner->buffer != nullptr ? inner->buffer->find(key) : nullptr;
+        if (item != nullptr && item->kind != kind::insert) {
+            return item->kind == kind::assign ? &*item->value : nullptr;
+        }
+        const Value * res = get(key, inner->data[inner->child_index(key)].second);
+        return res == nullptr && item != nullptr ? &*item->value : res;
+    }
+
+    static void collect(node_type * node, const std::size_t depth, std::vector<std::pair<std::size_t, message>> & items)
+    {
+        auto * inner = dynamic_cast<inner_type *>(node);
+        if (inner == nullptr) {
+            return;
+        }
+        if (inner->buffer != nullptr) {
+            for (auto & item : inner->buffer->take_all()) {
+                items.emplace_back(depth, std::move(item));
+            }
+        }
+        for (std::size_t i = 0; i < inner->size; ++i) {
+            collect(inner->data[i].second, depth + 1, items);
+        }
+    }
+
+    template <class F>
+    static void visit(const node_type * node, F && f)
+    {
+        if (const auto * inner = dynamic_cast<const inner_type *>(node)) {
+            f(inner);
+            for (std::size_t i = 0; i < inner->size; ++i) {
+                visit(inner->data[i].second, f);
+            }
+        }
+    }
+
+    tree_type tree;
+    std::vector<message> staged;
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "bptree.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Read position in a tree which keeps the path from the root to its leaf: the inner nodes, the
+// slot taken in each of them and the key range of each of them. A seek climbs only until the range
+// of a node on the path holds the key and descends from there, so reseeking near the current
+// position costs O(1) levels instead of O(height). Leaves are stepped through along the path in
+// both directions. Like iterators, a cursor is invalidated by any change of the tree
+template <class Key, class Value, class Less>
+class Cursor
+{
+    using leaf_type = Leaf<Key, Value, Less>;
+    using inner_type = Inner_node<Key, Value, Less>;
+    using slot = leaf_slot<Key, Value>;
+
+    struct frame
+    {
+        const inner_type * node;
+        std::size_t slot;
+        // range of the node, nullptr where it is unbounded
+        const Key * lower;
+        const Key * upper;
+    };
+
+public:
+    using value_type = typename slot::record;
+
+    // At the first element of the tree
+    explicit Cursor(const Node<Key, Value, Less> * root)
+        : root(root)
+    {
+        descend(root, 0, nullptr, nullptr, [](const inner_type &) {
+            return std::size_t(0);
+        });
+        pos = 0;
+        skip_empty();
+    }
+
+    bool valid() const
+    {
+        return pos < leaf->size;
+    }
+
+    typename slot::const_reference operator*() const
+    {
+        return slot::get(leaf->data[pos]);
+    }
+
+    typename slot::const_pointer operator->() const
+    {
+        return slot::address(leaf->data[pos]);
+    }
+
+    const Key & key() const
+    {
+        return leaf->data[pos].first;
+    }
+
+    // Moves to the first element not less than key
+    void seek(const Key & key)
+    {
+        std::size_t depth = path.size();
+        while (depth > 0 && !holds(lower_of(depth), upper_of(depth), key)) {
+            depth--;
+        }
+        if (depth < path.size()) {
+            const frame top = path[depth];
+            descend(top.node, depth, top.lower, top.upper, [&key](const inner_type & node) {
+                return node.child_index(key);
+            });
+        }
+        pos = leaf->position(key);
+        skip_empty();
+    }
+
+    // seek for keys which do not decrease from one call to the next: the rest of the current leaf
+    // is searched first
+    void seek_ge(const Key & key)
+    {
+        if (!valid() || !(leaf->data[pos].first < key)) {
+            return;
+        }
+        if (!(leaf->data[leaf->size - 1].first < key)) {
+            pos = leaf->position(key, pos + 1);
+            return;
+        }
+        seek(key);
+    }
+
+    void next()
+    {
+        if (valid() && ++pos == leaf->size) {
+            next_leaf();
+        }
+    }
+
+    // To the first element of the next leaf, past the end if there is none
+    void next_leaf()
+    {
+        pos = 0;
+        if (!step(true)) {
+            pos = leaf->size;
+            return;
+        }
+        skip_empty();
+    }
+
+    // To the first element of the previous leaf, or of the last one when past the end. Stays at
+    // the first leaf if there is none
+    void prev_leaf()
+    {
+        const bool ended = !valid();
+        pos = 0;
+        if (ended && leaf->size > 0) {
+            return;
+        }
+        while (step(false)) {
+            if (leaf->size > 0) {
+                return;
+            }
+        }
+        skip_empty();
+    }
+
+    // Inner nodes above the leaf
+    std::size_t depth() const
+    {
+        return path.size();
+    }
+
+private:
+    static bool holds(const Key * lower, const Key * upper, const Key & key)
+    {
+        return (lower == nullptr || !(key < *lower)) && (upper == nullptr || key < *upper);
+    }
+
+    // Range of the node below the path entry depth - 1, the leaf is at depth path.size()
+    const Key * lower_of(const std::size_t depth) const
+    {
+        const frame & above = path[depth - 1];
+        return above.slot > 0 ? &above.node->data[above.slot].first : above.lower;
+    }
+
+    const Key * upper_of(const std::size_t depth) const
+    {
+        const frame & above = path[depth - 1];
+        return above.slot + 1 < above.node->size ? &above.node->data[above.slot + 1].first : above.upper;
+    }
+
+    // Descends from node, which has the given range and depth, taking the slot choose picks
+    template <class F>
+    void descend(const Node<Key, Value, Less> * node, const std::size_t depth, const Key * lower, const Key * upper, F && choose)
+    {
+        path.resize(depth);
+        while (const auto * inner = dynamic_cast<const inner_type *>(node)) {
+            const std::size_t k = choose(*inner);
+            path.push_back(frame{inner, k, lower, upper});
+            lower = lower_of(path.size());
+            upper = upper_of(path.size());
+            node = inner->data[k].second;
+        }
+        leaf = static_cast<const leaf_type *>(node);
+    }
+
+    // Moves the path to the next or the previous leaf, false at the edge of the tree
+    bool step(const bool forward)
+    {
+        std::size_t depth = path.size();
+        while (depth > 0 && (forward ? path[depth - 1].slot + 1 == path[depth - 1].node->size : path[depth - 1].slot == 0)) {
+            depth--;
+        }
+        if (depth == 0) {
+            return false;
+        }
+        frame & turn = path[depth - 1];
+        turn.slot += forward ? 1 : -1;
+        const Key * lower = lower_of(depth);
+        const Key * upper = upper_of(depth);
+        descend(turn.node->data[turn.slot].second, depth, lower, upper, [forward](const inner_type & node) {
+            return forward ? std::size_t(0) : node.size - 1;
+        });
+        return true;
+    }
+
+    // Past the end of the leaf and over empty leaves to the next element
+    void skip_empty()
+    {
+        while (pos == leaf->size) {
+            pos = 0;
+            if (!step(true)) {
+                pos = leaf->size;
+                return;
+            }
+        }
+    }
+
+    const Node<Key, Value, Less> * root;
+    std::vector<frame> path;
+    const leaf_type * leaf = nullptr;
+    std::size_t pos = 0;
+};
+
+template <class Key, class Value, class Less, class Allocator>
+Cursor<Key, Value, Less> BPTree<Key, Value, Less, Allocator>::cursor() const
+{
+    return Cursor<Key, Value, Less>(root);
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation. A reader pins the current epoch for as long as it holds pointers into
+// a structure, an object unlinked by the writer is retired with the epoch it was unlinked in and
+// freed once every pinned reader has announced a later epoch
+class Epoch_manager
+{
+    static constexpr std::uint64_t idle = std::numeric_limits<std::uint64_t>::max();
+
+    struct alignas(64) slot
+    {
+        std::atomic<std::uint64_t> epoch{idle};
+    };
+
+public:
+    static constexpr std::size_t max_readers = 64;
+
+    class guard
+    {
+    public:
+        guard() = default;
+
+        guard(const guard &) = delete;
+
+        guard(guard && other) noexcept
+            : announced(std::exchange(other.announced, nullptr))
+        {
+        }
+
+        guard & operator=(const guard &) = delete;
+
+        guard & operator=(guard && other) noexcept
+        {
+            release();
+            announced = std::exchange(other.announced, nullptr);
+            return *this;
+        }
+
+        ~guard()
+        {
+            release();
+        }
+
+        void release()
+        {
+            if (announced != nullptr) {
+                announced->store(idle, std::memory_order_release);
+                announced = nullptr;
+            }
+        }
+
+    private:
+        friend class Epoch_manager;
+
+        explicit guard(std::atomic<std::uint64_t> * announced)
+            : announced(announced)
+        {
+        }
+
+        std::atomic<std::uint64_t> * announced = nullptr;
+    };
+
+    // Claims a reader slot and announces the current epoch in it, waits while all slots are taken
+    guard pin() const
+    {
+        std::size_t i = std::hash<std::thread::id>()(std::this_thread::get_id()) % max_readers;
+        for (;; i = (i + 1) % max_readers) {
+            auto & announced = slots[i].epoch;
+            std::uint64_t expected = idle;
+            std::uint64_t epoch = global.load();
+            if (!announced.compare_exchange_strong(expected, epoch)) {
+                if (i + 1 == max_readers) {
+                    std::this_thread::yield();
+                }
+                continue;
+            }
+            // the writer may have moved on between the load and the announcement
+            while (epoch != global.load()) {
+                epoch = global.load();
+                announced.store(epoch);
+            }
+            return guard(&announced);
+        }
+    }
+
+    std::uint64_t current() const
+    {
+        return global.load();
+    }
+
+    void advance()
+    {
+        global.fetch_add(1);
+    }
+
+    // Objects retired in epochs before this one are not reachable by any pinned reader
+    std::uint64_t safe() const
+    {
+        std::uint64_t res = idle;
+        for (const auto & item : slots) {
+            res = std::min(res, item.epoch.load());
+        }
+        return res;
+    }
+
+private:
+    mutable std::array<slot, max_readers> slots;
+    std::atomic<std::uint64_t> global{1};
+};
+
+// Objects waiting for the readers of their retire epoch to go away
+template <class T>
+class Retire_list
+{
+public:
+    Retire_list() = default;
+
+    Retire_list(const Retire_list &) = delete;
+
+    Retire_list(Retire_list && list) noexcept
+        : items(std::move(list.items))
+    {
+        list.items.clear();
+    }
+
+    Retire_list & operator=(const Retire_list &) = delete;
+
+    // Appends the objects of another list of the same epoch manager, nothing is freed before its
+    // readers are gone
+    Retire_list & operator=(Retire_list && list)
+    {
+        if (this != &list) {
+            items.insert(items.end(), list.items.begin(), list.items.end());
+            list.items.clear();
+        }
+        return *this;
+    }
+
+    ~Retire_list()
+    {
+        clear();
+    }
+
+    std::size_t size() const
+    {
+        return items.size();
+    }
+
+    void retire(T * item, const std::uint64_t epoch)
+    {
+        if (item != nullptr) {
+            items.emplace_back(epoch, item);
+        }
+    }
+
+    // Frees the objects retired before the safe epoch
+    void reclaim(const std::uint64_t safe)
+    {
+        const auto it = std::partition(items.begin(), items.end(), [safe](const auto & item) {
+            return item.first >= safe;
+        });
+        for (auto i = it; i != items.end(); ++i) {
+            delete i->second;
+        }
+        items.erase(it, items.end());
+    }
+
+    void clear()
+    {
+        reclaim(std::numeric_limits<std::uint64_t>::max());
+    }
+
+    void swap(Retire_list & list) noexcept
+    {
+        items.swap(list.items);
+    }
+
+private:
+    std::vector<std::pair<std::uint64_t, T *>> items;
+};
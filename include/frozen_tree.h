@@ -0,0 +1,449 @@
+#pragma once
+
+#include "bptree.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Immutable B+ tree in one flat buffer without pointers. Every level is an array of fully packed
+// nodes of node_keys keys, the children of node k of a level are the nodes k * (node_keys + 1) + i
+// of the level below. The bottom level is the sorted key array itself and the values are a
+// parallel array after it. The buffer starts with a header and holds only offsets, so it can be
+// written to a file as is and used in place after mapping the file back
+template <class Key, class Value, class Less = std::less<Key>>
+class FrozenBPTree
+{
+    static_assert(std::is_trivially_copyable_v<Key>, "frozen trees need trivially copyable keys");
+    static_assert(std::is_trivially_copyable_v<Value>, "frozen trees need trivially copyable values");
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<Key, Value>;
+    using size_type = std::size_t;
+
+    // A node spans two cache lines
+    static constexpr std::size_t node_keys = std::max<std::size_t>(4, 128 / sizeof(Key));
+    static constexpr std::size_t max_levels = 16;
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = std::pair<Key, Value>;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::pair<const Key &, const Value &>;
+
+        class pointer
+        {
+        public:
+            const reference * operator->() const
+            {
+                return &item;
+            }
+
+            reference item;
+        };
+
+        const_iterator() = default;
+
+        const_iterator(const FrozenBPTree * tree, const std::size_t pos)
+            : tree(tree)
+            , pos(pos)
+        {
+        }
+
+        const_iterator & operator++()
+        {
+            ++pos;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            auto res = *this;
+            ++pos;
+            return res;
+        }
+
+        const_iterator & operator--()
+        {
+            --pos;
+            return *this;
+        }
+
+        const_iterator operator--(int)
+        {
+            auto res = *this;
+            --pos;
+            return res;
+        }
+
+        const_iterator & operator+=(const difference_type n)
+        {
+            pos += n;
+            return *this;
+        }
+
+        const_iterator & operator-=(const difference_type n)
+        {
+            pos -= n;
+            return *this;
+        }
+
+        friend const_iterator operator+(const_iterator it, const difference_type n)
+        {
+            return it += n;
+        }
+
+        friend const_iterator operator-(const_iterator it, const difference_type n)
+        {
+            return it -= n;
+        }
+
+        friend difference_type operator-(const const_iterator & a, const const_iterator & b)
+        {
+            return static_cast<difference_type>(a.pos) - static_cast<difference_type>(b.pos);
+        }
+
+        reference operator*() const
+        {
+            return {tree->keys()[pos], tree->values()[pos]};
+        }
+
+        reference operator[](const difference_type n) const
+        {
+            return *(*this + n);
+        }
+
+        pointer operator->() const
+        {
+            return pointer{**this};
+        }
+
+        friend bool operator==(const const_iterator & a, const const_iterator & b)
+        {
+            return a.pos == b.pos;
+        }
+
+        friend bool operator!=(const const_iterator & a, const const_iterator & b)
+        {
+            return !(a == b);
+        }
+
+        friend bool operator<(const const_iterator & a, const const_iterator & b)
+        {
+            return a.pos < b.pos;
+        }
+
+    private:
+        const FrozenBPTree * tree = nullptr;
+        std::size_t pos = 0;
+    };
+
+    using iterator = const_iterator;
+
+    FrozenBPTree()
+        : FrozenBPTree(static_cast<const value_type *>(nullptr), static_cast<const value_type *>(nullptr))
+    {
+    }
+
+    template <class Allocator>
+    explicit FrozenBPTree(const BPTree<Key, Value, Less, Allocator> & tree)
+        : FrozenBPTree(tree.begin(), tree.end())
+    {
+    }
+
+    // Builds the tree from a sorted sequence of unique keys
+    template <class It>
+    FrozenBPTree(It begin, const It end)
+    {
+        std::vector<Key> items_keys;
+        std::vector<Value> items_values;
+        for (; begin != end; ++begin) {
+            if (!items_keys.empty() && !(items_keys.back() < begin->first)) {
+                throw std::invalid_argument("FrozenBPTree: keys are not sorted and unique");
+            }
+            items_keys.push_back(begin->first);
+            items_values.push_back(begin->second);
+        }
+        build(items_keys, items_values);
+    }
+
+    FrozenBPTree(const FrozenBPTree & tree)
+        : storage(tree.storage)
+        , base(tree.owned() ? storage.front().bytes : tree.base)
+    {
+    }
+
+    FrozenBPTree(FrozenBPTree && tree) noexcept
+        : storage(std::move(tree.storage))
+        , base(tree.base)
+    {
+    }
+
+    FrozenBPTree & operator=(FrozenBPTree tree) noexcept
+    {
+        storage.swap(tree.storage);
+        std::swap(base, tree.base);
+        return *this;
+    }
+
+    // Uses a buffer produced by data() in place, e.g. a mapped file. The buffer has to stay
+    // valid and unchanged for the lifetime of the tree
+    static FrozenBPTree view(const void * buffer, const std::size_t size)
+    {
+        FrozenBPTree res;
+        res.storage.clear();
+        res.base = static_cast<const unsigned char *>(buffer);
+        res.check(size);
+        return res;
+    }
+
+    // The flat representation of the tree
+    const unsigned char * data() const
+    {
+        return base;
+    }
+
+    std::size_t data_size() const
+    {
+        return head().total_size;
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(this, size());
+    }
+
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+
+    const_iterator cend() const
+    {
+        return end();
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    size_type size() const
+    {
+        return head().count;
+    }
+
+    const_iterator lower_bound(const Key & key) const
+    {
+        return const_iterator(this, lower_index(key));
+    }
+
+    const_iterator upper_bound(const Key & key) const
+    {
+        std::size_t res = lower_index(key);
+        if (res < size() && !(key < keys()[res])) {
+            res++;
+        }
+        return const_iterator(this, res);
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const Key & key) const
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    const_iterator find(const Key & key) const
+    {
+        const std::size_t res = lower_index(key);
+        return res < size() && !(key < keys()[res]) ? const_iterator(this, res) : end();
+    }
+
+    bool contains(const Key & key) const
+    {
+        return find(key) != end();
+    }
+
+    size_type count(const Key & key) const
+    {
+        return contains(key) ? 1 : 0;
+    }
+
+    const Value & at(const Key & key) const
+    {
+        const std::size_t res = lower_index(key);
+        if (res == size() || key < keys()[res]) {
+            throw std::out_of_range("Key not found");
+        }
+        return values()[res];
+    }
+
+private:
+    static constexpr std::uint64_t magic = 0x315a4f5246545042; // "BPTFROZ1"
+    static constexpr std::size_t line_size = 64;
+
+    struct header
+    {
+        std::uint64_t magic;
+        std::uint32_t key_size;
+        std::uint32_t value_size;
+        std::uint32_t node_keys;
+        std::uint32_t levels;
+        std::uint64_t count;
+        std::uint64_t total_size;
+        std::uint64_t values_offset;
+        // levels from the root down, the last one is the key array
+        std::array<std::uint64_t, max_levels> level_offsets;
+        std::array<std::uint64_t, max_levels> level_sizes;
+    };
+
+    struct alignas(line_size) line
+    {
+        unsigned char bytes[line_size];
+    };
+
+    static constexpr std::size_t align(const std::size_t n)
+    {
+        return (n + line_size - 1) / line_size * line_size;
+    }
+
+    bool owned() const
+    {
+        return !storage.empty();
+    }
+
+    const header & head() const
+    {
+        return *reinterpret_cast<const header *>(base);
+    }
+
+    const Key * level(const std::size_t i) const
+    {
+        return reinterpret_cast<const Key *>(base + head().level_offsets[i]);
+    }
+
+    const Key * keys() const
+    {
+        return level(head().levels - 1);
+    }
+
+    const Value * values() const
+    {
+        return reinterpret_cast<const Value *>(base + head().values_offset);
+    }
+
+    // Index of the first key not less than key: one node per level, the slot found in a node
+    // is the child to descend to
+    std::size_t lower_index(const Key & key) const
+    {
+        const header & h = head();
+        std::size_t node = 0;
+        for (std::size_t i = 0; i < h.levels; ++i) {
+            const Key * level_keys = level(i);
+            const std::size_t first = node * node_keys;
+            const std::size_t last = std::min<std::size_t>(first + node_keys, h.level_sizes[i]);
+            const std::size_t slot = std::lower_bound(level_keys + first, level_keys + last, key) - level_keys;
+            if (i + 1 == h.levels) {
+                return slot;
+            }
+            node = node * (node_keys + 1) + (slot - first);
+        }
+        return 0;
+    }
+
+    void build(const std::vector<Key> & items_keys, const std::vector<Value> & items_values)
+    {
+        const std::size_t n = items_keys.size();
+        // inner levels from the bottom up: entry f of a level separates its children
+        // f / node_keys * (node_keys + 1) + f % node_keys and the next one, so it is the
+        // smallest key of the latter, 'span' is the number of leaf blocks below one child
+        std::vector<std::vector<Key>> inner;
+        std::size_t children = (n + node_keys - 1) / node_keys;
+        std::size_t span = 1;
+        while (children > 1) {
+            std::vector<Key> level_keys;
+            for (std::size_t f = 0;; ++f) {
+                const std::size_t child = f / node_keys * (node_keys + 1) + f % node_keys + 1;
+                if (child >= children) {
+                    break;
+                }
+                level_keys.push_back(items_keys[child * span * node_keys]);
+            }
+            children = (children + node_keys) / (node_keys + 1);
+            span *= node_keys + 1;
+            inner.push_back(std::move(level_keys));
+        }
+        if (inner.size() + 1 > max_levels) {
+            throw std::length_error("FrozenBPTree: too many levels");
+        }
+
+        header h{};
+        h.magic = magic;
+        h.key_size = sizeof(Key);
+        h.value_size = sizeof(Value);
+        h.node_keys = node_keys;
+        h.levels = static_cast<std::uint32_t>(inner.size() + 1);
+        h.count = n;
+        std::size_t offset = align(sizeof(header));
+        for (std::size_t i = 0; i < inner.size(); ++i) {
+            h.level_offsets[i] = offset;
+            h.level_sizes[i] = inner[inner.size() - 1 - i].size();
+            offset = align(offset + h.level_sizes[i] * sizeof(Key));
+        }
+        h.level_offsets[inner.size()] = offset;
+        h.level_sizes[inner.size()] = n;
+        offset = align(offset + n * sizeof(Key));
+        h.values_offset = offset;
+        h.total_size = align(offset + n * sizeof(Value));
+
+        storage.assign(h.total_size / line_size, line{});
+        auto * out = storage.front().bytes;
+        std::memcpy(out, &h, sizeof(header));
+        for (std::size_t i = 0; i < inner.size(); ++i) {
+            const auto & level_keys = inner[inner.size() - 1 - i];
+            std::memcpy(out + h.level_offsets[i], level_keys.data(), level_keys.size() * sizeof(Key));
+        }
+        if (n > 0) {
+            std::memcpy(out + h.level_offsets[inner.size()], items_keys.data(), n * sizeof(Key));
+            std::memcpy(out + h.values_offset, items_values.data(), n * sizeof(Value));
+        }
+        base = out;
+    }
+
+    void check(const std::size_t size) const
+    {
+        if (size < sizeof(header) || reinterpret_cast<std::uintptr_t>(base) % alignof(header) != 0) {
+            throw std::invalid_argument("FrozenBPTree: buffer is too small or misaligned");
+        }
+        const header & h = head();
+        if (h.magic != magic || h.key_size != sizeof(Key) || h.value_size != sizeof(Value) || h.node_keys != node_keys ||
+            h.levels == 0 || h.levels > max_levels || h.total_size > size) {
+            throw std::invalid_argument("FrozenBPTree: buffer does not hold a tree of this type");
+        }
+    }
+
+    std::vector<line> storage;
+    const unsigned char * base = nullptr;
+};
+
+template <class Key, class Value, class Less, class Allocator>
+FrozenBPTree<Key, Value, Less> BPTree<Key, Value, Less, Allocator>::freeze() const
+{
+    return FrozenBPTree<Key, Value, Less>(*this);
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <class Key, class Value, class Less>
+class Leaf;
+
+// Front cache of the leaf slots of hot keys: a set-associative open-addressing table with four
+// ways per 64-byte set, replaced CLOCK-style through a reference bit per way. An entry keeps only
+// a tag of the hash, the leaf and the slot, a hit is confirmed by the key in that slot, so an
+// insert or erase that shifts the key away just turns the entry into a miss. Leaves cannot be
+// checked once they are gone: the owner calls invalidate whenever it retires or hands away leaves,
+// which drops every entry at once through a stamp. Entries are relaxed atomics, so concurrent
+// readers may share the cache; the counters may lose a few counts then
+template <class Key, class Value, class Less>
+class Hot_cache
+{
+    using leaf_type = Leaf<Key, Value, Less>;
+
+    static constexpr std::size_t ways = 4;
+
+    struct entry
+    {
+        std::atomic<leaf_type *> leaf{nullptr};
+        // entries of older stamps are empty
+        std::atomic<std::uint32_t> stamp{0};
+        std::atomic<std::uint16_t> pos{0};
+        std::atomic<std::uint8_t> tag{0};
+        std::atomic<std::uint8_t> referenced{0};
+    };
+
+    struct alignas(64) set
+    {
+        std::array<entry, ways> entries;
+    };
+
+public:
+    // whether the keys can be hashed with std::hash
+    static constexpr bool supported = std::is_default_constructible_v<std::hash<Key>>;
+
+    struct stats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        // entries found for a key that had left its slot
+        std::uint64_t stale = 0;
+        // invalidations of the whole cache
+        std::uint64_t flushes = 0;
+
+        double hit_rate() const
+        {
+            return hits + misses == 0 ? 0 : double(hits) / double(hits + misses);
+        }
+    };
+
+    explicit Hot_cache(const std::size_t capacity)
+        : sets(std::max<std::size_t>((capacity + ways - 1) / ways, 1))
+    {
+    }
+
+    std::size_t capacity() const
+    {
+        return sets.size() * ways;
+    }
+
+    // Leaf and slot of key, a null leaf on a miss
+    std::pair<leaf_type *, std::size_t> find(const Key & key)
+    {
+        const std::uint64_t h = hash(key);
+        const std::uint8_t tag = tag_of(h);
+        const std::uint32_t current = stamp.load(std::memory_order_relaxed);
+        for (entry & e : sets[index(h)].entries) {
+            if (e.stamp.load(std::memory_order_relaxed) != current || e.tag.load(std::memory_order_relaxed) != tag) {
+                continue;
+            }
+            leaf_type * leaf = e.leaf.load(std::memory_order_relaxed);
+            const std::size_t pos = e.pos.load(std::memory_order_relaxed);
+            if (pos < leaf->size && leaf->data[pos].first == key) {
+                if (e.referenced.load(std::memory_order_relaxed) == 0) {
+                    e.referenced.store(1, std::memory_order_relaxed);
+                }
+                count(counters.hits);
+                return {leaf, pos};
+            }
+            // the entry stays if it belongs to another key with the same tag
+            if (pos >= leaf->size || !same_place(hash(leaf->data[pos].first), h)) {
+                e.stamp.store(0, std::memory_order_relaxed);
+                count(counters.stale);
+            }
+        }
+        count(counters.misses);
+        return {nullptr, 0};
+    }
+
+    // Remembers the slot a lookup found key at, evicting the first unreferenced way of its set
+    void remember(const Key & key, leaf_type * leaf, const std::size_t pos)
+    {
+        static_assert(leaf_type::max_size <= 0x10000, "slot positions must fit in 16 bits");
+        const std::uint64_t h = hash(key);
+        const std::uint32_t current = stamp.load(std::memory_order_relaxed);
+        auto & entries = sets[index(h)].entries;
+        entry * victim = nullptr;
+        for (entry & e : entries) {
+            if (e.stamp.load(std::memory_order_relaxed) != current) {
+                victim = &e;
+                break;
+            }
+        }
+        for (std::size_t i = 0; victim == nullptr; ++i) {
+            entry & e = entries[((h >> 16) + i) & (ways - 1)];
+            if (e.referenced.load(std::memory_order_relaxed) == 0) {
+                victim = &e;
+            }
+            else {
+                e.referenced.store(0, std::memory_order_relaxed);
+            }
+        }
+        victim->stamp.store(0, std::memory_order_relaxed);
+        victim->leaf.store(leaf, std::memory_order_relaxed);
+        victim->pos.store(static_cast<std::uint16_t>(pos), std::memory_order_relaxed);
+        victim->tag.store(tag_of(h), std::memory_order_relaxed);
+        victim->referenced.store(0, std::memory_order_relaxed);
+        victim->stamp.store(current, std::memory_order_relaxed);
+    }
+
+    // Drops all entries, the leaves they point to may be gone
+    void invalidate()
+    {
+        std::uint32_t next = stamp.load(std::memory_order_relaxed) + 1;
+        if (next == 0) {
+            // a wrapped stamp would revive entries of the last round
+            for (set & s : sets) {
+                for (entry & e : s.entries) {
+                    e.stamp.store(0, std::memory_order_relaxed);
+                }
+            }
+            next = 1;
+        }
+        stamp.store(next, std::memory_order_relaxed);
+        count(counters.flushes);
+    }
+
+    stats statistics() const
+    {
+        stats res;
+        res.hits = counters.hits.load(std::memory_order_relaxed);
+        res.misses = counters.misses.load(std::memory_order_relaxed);
+        res.stale = counters.stale.load(std::memory_order_relaxed);
+        res.flushes = counters.flushes.load(std::memory_order_relaxed);
+        return res;
+    }
+
+private:
+    static std::uint64_t hash(const Key & key)
+    {
+        if constexpr (supported) {
+            return static_cast<std::uint64_t>(std::hash<Key>()(key)) * 0x9e3779b97f4a7c15;
+        }
+        else {
+            return 0;
+        }
+    }
+
+    std::size_t index(const std::uint64_t h) const
+    {
+        return static_cast<std::size_t>((h >> 32) * sets.size() >> 32);
+    }
+
+    // bits below the ones index takes
+    static std::uint8_t tag_of(const std::uint64_t h)
+    {
+        return static_cast<std::uint8_t>(h >> 24);
+    }
+
+    bool same_place(const std::uint64_t a, const std::uint64_t b) const
+    {
+        return tag_of(a) == tag_of(b) && index(a) == index(b);
+    }
+
+    // plain load and store instead of an atomic increment, lookups stay free of locked instructions
+    static void count(std::atomic<std::uint64_t> & counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    struct
+    {
+        std::atomic<std::uint64_t> hits{0};
+        std::atomic<std::uint64_t> misses{0};
+        std::atomic<std::uint64_t> stale{0};
+        std::atomic<std::uint64_t> flushes{0};
+    } counters;
+    std::atomic<std::uint32_t> stamp{1};
+    std::vector<set> sets;
+};
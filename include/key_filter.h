@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+// Split block Bloom filter over the keys of a tree: a key sets one bit in each of the eight words
+// of a single 64-byte block, so a query reads one cache line. Erased keys cannot be taken out,
+// the owner rebuilds the filter once too many keys were added or erased since it was built
+template <class Key>
+class Key_filter
+{
+    struct alignas(64) block
+    {
+        std::array<std::uint64_t, 8> words{};
+    };
+
+public:
+    static constexpr std::size_t bits_per_key = 16;
+    // whether the keys can be hashed with std::hash
+    static constexpr bool supported = std::is_default_constructible_v<std::hash<Key>>;
+
+    explicit Key_filter(const std::size_t capacity)
+        : capacity(std::max<std::size_t>(capacity, 512 / bits_per_key))
+        , blocks(this->capacity * bits_per_key / 512)
+    {
+    }
+
+    void add(const Key & key)
+    {
+        const std::uint64_t h = hash(key);
+        auto & words = blocks[index(h)].words;
+        for (std::size_t i = 0; i < words.size(); ++i) {
+            words[i] |= bit(h, i);
+        }
+        added++;
+    }
+
+    bool may_contain(const Key & key) const
+    {
+        const std::uint64_t h = hash(key);
+        const auto & words = blocks[index(h)].words;
+        for (std::size_t i = 0; i < words.size(); ++i) {
+            if ((words[i] & bit(h, i)) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void erased()
+    {
+        removed++;
+    }
+
+    // Added more keys than it was sized for, or half of the added ones are gone
+    bool stale() const
+    {
+        return added > capacity || 2 * removed > std::max(added, capacity / 2);
+    }
+
+    // Takes in the keys of a filter of the same size
+    bool merge(const Key_filter & filter)
+    {
+        if (filter.blocks.size() != blocks.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < blocks.size(); ++i) {
+            for (std::size_t j = 0; j < blocks[i].words.size(); ++j) {
+                blocks[i].words[j] |= filter.blocks[i].words[j];
+            }
+        }
+        added += filter.added;
+        removed += filter.removed;
+        return true;
+    }
+
+private:
+    static std::uint64_t hash(const Key & key)
+    {
+        if constexpr (supported) {
+            return static_cast<std::uint64_t>(std::hash<Key>()(key)) * 0x9e3779b97f4a7c15;
+        }
+        else {
+            return 0;
+        }
+    }
+
+    std::size_t index(const std::uint64_t h) const
+    {
+        return static_cast<std::size_t>((h >> 32) * blocks.size() >> 32);
+    }
+
+    // Bit of word i: six bits of the low half of the hash, rehashed for every word
+    static std::uint64_t bit(const std::uint64_t h, const std::size_t i)
+    {
+        static constexpr std::array<std::uint32_t, 8> salts = {
+                0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d, 0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31};
+        return std::uint64_t(1) << ((static_cast<std::uint32_t>(h) * salts[i]) >> 26);
+    }
+
+    std::size_t capacity;
+    std::size_t added = 0;
+    std::size_t removed = 0;
+    std::vector<block> blocks;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Pending updates kept in an inner node in buffered mode, at most one message per key.
+// Messages higher up in the tree are always newer than the ones below them
+template <class Key, class Value>
+class Message_buffer
+{
+public:
+    enum class Kind : unsigned char
+    {
+        insert,
+        assign,
+        erase
+    };
+
+    struct message
+    {
+        Key key;
+        Kind kind;
+        std::optional<Value> value;
+    };
+
+    using const_iterator = typename std::vector<message>::const_iterator;
+
+    bool empty() const
+    {
+        return messages.empty();
+    }
+
+    std::size_t size() const
+    {
+        return messages.size();
+    }
+
+    const_iterator begin() const
+    {
+        return messages.begin();
+    }
+
+    const_iterator end() const
+    {
+        return messages.end();
+    }
+
+    // Adds a message which is newer than all buffered ones
+    void add(message && item)
+    {
+        const auto it = position(item.key);
+        if (it != messages.end() && it->key == item.key) {
+            combine(*it, std::move(item));
+        }
+        else {
+            messages.insert(it, std::move(item));
+        }
+    }
+
+    // Adds a message which is older than all buffered ones
+    void add_older(message && item)
+    {
+        const auto it = position(item.key);
+        if (it != messages.end() && it->key == item.key) {
+            combine(item, std::move(*it));
+            *it = std::move(item);
+        }
+        else {
+            messages.insert(it, std::move(item));
+        }
+    }
+
+    // Adds all messages of a buffer whose messages are newer than the buffered ones
+    void add(Message_buffer && buffer)
+    {
+        add(std::make_move_iterator(buffer.messages.begin()), std::make_move_iterator(buffer.messages.end()));
+        buffer.messages.clear();
+    }
+
+    // Merges a sorted range of messages which are newer than the buffered ones
+    template <class It>
+    void add(It first, const It last)
+    {
+        if (messages.empty()) {
+            messages.assign(first, last);
+            return;
+        }
+        std::vector<message> res;
+        res.reserve(messages.size() + std::distance(first, last));
+        auto i = std::make_move_iterator(messages.begin());
+        const auto end = std::make_move_iterator(messages.end());
+        while (i != end && first != last) {
+            if (i->key < first->key) {
+                res.push_back(*i++);
+            }
+            else if (first->key < i->key) {
+                res.push_back(*first++);
+            }
+            else {
+                res.push_back(*i++);
+                combine(res.back(), message(*first++));
+            }
+        }
+        res.insert(res.end(), i, end);
+        res.insert(res.end(), first, last);
+        messages = std::move(res);
+    }
+
+    const message * find(const Key & key) const
+    {
+        const auto it = std::lower_bound(messages.begin(), messages.end(), key, [](const auto & lhs, const auto & rhs) {
+            return lhs.key < rhs;
+        });
+        return it != messages.end() && it->key == key ? &*it : nullptr;
+    }
+
+    // Moves the messages with keys not less than key to the (empty) right buffer
+    void split(const Key & key, Message_buffer & right)
+    {
+        const auto it = position(key);
+        right.messages.assign(std::make_move_iterator(it), std::make_move_iterator(messages.end()));
+        messages.erase(it, messages.end());
+    }
+
+    // Removes and returns the messages with keys in [from, to), an empty bound means no bound
+    std::vector<message> take(const std::optional<Key> & from, const std::optional<Key> & to)
+    {
+        const auto first = from ? position(*from) : messages.begin();
+        const auto last = to ? position(*to) : messages.end();
+        std::vector<message> res(std::make_move_iterator(first), std::make_move_iterator(last));
+        messages.erase(first, last);
+        return res;
+    }
+
+    std::vector<message> take_all()
+    {
+        return std::exchange(messages, std::vector<message>());
+    }
+
+    // Folds a newer message for the same key into an older one
+    static void combine(message & older, message && newer)
+    {
+        if (newer.kind != Kind::insert) {
+            older = std::move(newer);
+        }
+        else if (older.kind == Kind::erase) {
+            older.kind = Kind::assign;
+            older.value = std::move(newer.value);
+        }
+    }
+
+private:
+    typename std::vector<message>::iterator position(const Key & key)
+    {
+        return std::lower_bound(messages.begin(), messages.end(), key, [](const auto & lhs, const auto & rhs) {
+            return lhs.key < rhs;
+        });
+    }
+
+    std::vector<message> messages;
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "bptree.h"
+
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+// Key of the underlying tree: user keys ordered by Less, equal ones told apart by their insertion
+// sequence number
+template <class Key, class Less = std::less<Key>>
+struct multi_key
+{
+    Key key;
+    std::size_t sequence;
+
+    friend bool operator<(const multi_key & a, const multi_key & b)
+    {
+        const Less less;
+        return less(a.key, b.key) || (!less(b.key, a.key) && a.sequence < b.sequence);
+    }
+
+    friend bool operator>(const multi_key & a, const multi_key & b)
+    {
+        return b < a;
+    }
+
+    friend bool operator==(const multi_key & a, const multi_key & b)
+    {
+        return a.sequence == b.sequence && !(a < b) && !(b < a);
+    }
+
+    friend bool operator!=(const multi_key & a, const multi_key & b)
+    {
+        return !(a == b);
+    }
+
+    friend std::ostream & operator<<(std::ostream & out, const multi_key & k)
+    {
+        return out << k.key << '#' << k.sequence;
+    }
+};
+
+template <class Key, class Value, class Base, bool constant>
+class multi_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::pair<const Key, Value>;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::pair<const Key &, std::conditional_t<constant, const Value &, Value &>>;
+
+    class pointer
+    {
+    public:
+        const reference * operator->() const
+        {
+            return &ref;
+        }
+
+        reference ref;
+    };
+
+    multi_iterator() = default;
+
+    explicit multi_iterator(Base it)
+        : it(it)
+    {
+    }
+
+    multi_iterator & operator++()
+    {
+        ++it;
+        return *this;
+    }
+
+    multi_iterator operator++(int)
+    {
+        auto res = *this;
+        operator++();
+        return res;
+    }
+
+    reference operator*() const
+    {
+        auto && item = *it;
+        return reference(item.first.key, item.second);
+    }
+
+    pointer operator->() const
+    {
+        return pointer{**this};
+    }
+
+    const Base & base() const
+    {
+        return it;
+    }
+
+    friend bool operator==(const multi_iterator & a, const multi_iterator & b)
+    {
+        return a.it == b.it;
+    }
+
+    friend bool operator!=(const multi_iterator & a, const multi_iterator & b)
+    {
+        return a.it != b.it;
+    }
+
+private:
+    Base it;
+};
+
+// B+ tree with duplicate keys. Duplicates are stored inline in the leaves under a composite
+// (key, sequence number) key, so equal keys keep their insertion order as in std::multimap and
+// a key with many values costs no allocation besides the leaves themselves
+template <class Key, class Value, class Less = std::less<Key>>
+class BPMultiTree
+{
+    using sequence = std::size_t;
+    using tree_key = multi_key<Key, Less>;
+    using tree_type = BPTree<tree_key, Value>;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using size_type = std::size_t;
+
+    using iterator = multi_iterator<Key, Value, typename tree_type::iterator, false>;
+    using const_iterator = multi_iterator<Key, Value, typename tree_type::const_iterator, true>;
+
+    BPMultiTree() = default;
+
+    BPMultiTree(std::initializer_list<std::pair<const Key, Value>> list)
+    {
+        insert(list);
+    }
+
+    iterator begin()
+    {
+        return iterator(tree.begin());
+    }
+
+    const_iterator cbegin() const
+    {
+        return const_iterator(tree.cbegin());
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(tree.begin());
+    }
+
+    iterator end()
+    {
+        return iterator(tree.end());
+    }
+
+    const_iterator cend() const
+    {
+        return const_iterator(tree.cend());
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(tree.end());
+    }
+
+    bool empty() const
+    {
+        return tree.empty();
+    }
+
+    size_type size() const
+    {
+        return tree.size();
+    }
+
+    void clear()
+    {
+        tree.clear();
+        next = 0;
+    }
+
+    size_type count(const Key & key) const
+    {
+        const auto range = equal_range(key);
+        return std::distance(range.first, range.second);
+    }
+
+    bool contains(const Key & key) const
+    {
+        return lower_bound(key) != upper_bound(key);
+    }
+
+    // First of the values stored under key
+    iterator find(const Key & key)
+    {
+        const auto res = lower_bound(key);
+        return res != upper_bound(key) ? res : end();
+    }
+
+    const_iterator find(const Key & key) const
+    {
+        const auto res = lower_bound(key);
+        return res != upper_bound(key) ? res : end();
+    }
+
+    std::pair<iterator, iterator> equal_range(const Key & key)
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const Key & key) const
+    {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    iterator lower_bound(const Key & key)
+    {
+        return iterator(tree.lower_bound(tree_key{key, 0}));
+    }
+
+    const_iterator lower_bound(const Key & key) const
+    {
+        return const_iterator(tree.lower_bound(tree_key{key, 0}));
+    }
+
+    iterator upper_bound(const Key & key)
+    {
+        return iterator(tree.upper_bound(tree_key{key, std::numeric_limits<sequence>::max()}));
+    }
+
+    const_iterator upper_bound(const Key & key) const
+    {
+        return const_iterator(tree.upper_bound(tree_key{key, std::numeric_limits<sequence>::max()}));
+    }
+
+    iterator insert(const Key & key, const Value & value)
+    {
+        return iterator(tree.insert(tree_key{key, next++}, value).first);
+    }
+
+    iterator insert(const Key & key, Value && value)
+    {
+        return iterator(tree.insert(tree_key{key, next++}, std::move(value)).first);
+    }
+
+    iterator insert(Key && key, Value && value)
+    {
+        return iterator(tree.insert(tree_key{std::move(key), next++}, std::move(value)).first);
+    }
+
+    template <class ForwardIt>
+    void insert(ForwardIt begin, ForwardIt end)
+    {
+        for (auto i = begin; i != end; ++i) {
+            insert(i->first, i->second);
+        }
+    }
+
+    void insert(std::initializer_list<value_type> list)
+    {
+        insert(list.begin(), list.end());
+    }
+
+    iterator erase(const_iterator it)
+    {
+        return iterator(tree.erase(it.base()));
+    }
+
+    iterator erase(iterator it)
+    {
+        return iterator(tree.erase(it.base()));
+    }
+
+    void erase(const_iterator begin, const_iterator end)
+    {
+        tree.erase(begin.base(), end.base());
+    }
+
+    // Removes all values stored under key
+    size_type erase(const Key & key)
+    {
+        const auto range = std::as_const(*this).equal_range(key);
+        const size_type res = std::distance(range.first, range.second);
+        if (res > 0) {
+            erase(range.first, range.second);
+        }
+        return res;
+    }
+
+private:
+    tree_type tree;
+    sequence next = 0;
+};
@@ -2,20 +2,39 @@
 #pragma once
 
 #include "bptree.h"
+#include "message_buffer.h"
+#include "node_arena.h"
+#include "node_search.h"
 #include "tree_iterator.h"
+#include "value_arena.h"
 
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
 #include <utility>
 
 template <class Key, class Value, class Less>
 class Inner_node;
 
+// Placement argument of node allocations: the memory resource of the tree the node belongs to
+struct node_resource
+{
+    std::pmr::memory_resource * resource;
+};
+
+inline void prefetch(const void * address)
+{
+    __builtin_prefetch(address);
+}
+
 template <class Key, class Value, class Less>
 class Leaf;
 
-template <class Key, class Value, class Less>
+// The allocator of a tree defaults here, node.h is always read before the definition in bptree.h
+template <class Key, class Value, class Less, class Allocator = std::allocator<std::pair<const Key, Value>>>
 class BPTree;
 
 template <class Key, class Value, class Less = std::less<Key>>
@@ -25,32 +44,78 @@ class Node
     using const_iterator = tree_iterator<Key, Value, Less, true>;
 
 public:
+    using slot_type = typename leaf_slot<Key, Value>::type;
+
     virtual ~Node() = default;
 
+    // Nodes of a tree with a memory resource come from that resource. Others are placed in the
+    // node arena while it is enabled, next to the hinted node when its region has room. A new node
+    // takes the resource of the node it is hinted to
+    static void * operator new(const std::size_t size)
+    {
+        return operator new(size, node_resource{nullptr});
+    }
+
+    static void * operator new(const std::size_t size, const near_hint hint)
+    {
+        return allocate(size, hint.node != nullptr ? header_of(hint.node).resource : nullptr, hint.node);
+    }
+
+    static void * operator new(const std::size_t size, const node_resource source)
+    {
+        return allocate(size, source.resource, nullptr);
+    }
+
+    static void operator delete(void * p)
+    {
+        const header & h = header_of(p);
+        void * base = static_cast<unsigned char *>(p) - header_size;
+        if (h.resource != nullptr) {
+            h.resource->deallocate(base, h.size, header_size);
+        }
+        else if ((h.size & in_arena) != 0) {
+            Node_arena::instance().deallocate(base);
+        }
+        else {
+            ::operator delete(base);
+        }
+    }
+
+    static void operator delete(void * p, near_hint)
+    {
+        operator delete(p);
+    }
+
+    static void operator delete(void * p, node_resource)
+    {
+        operator delete(p);
+    }
+
+    // Memory resource the node was allocated from, nullptr for the node arena or the global heap
+    std::pmr::memory_resource * resource() const
+    {
+        return header_of(this).resource;
+    }
+
     virtual std::pair<Node &, std::size_t> lower(const Key & key) = 0;
 
     virtual std::pair<Node &, std::size_t> upper(const Key & key) = 0;
 
-    virtual Node * push(Node * root, Key key, Node * new_child) = 0;
+    // Leaf whose key range contains key, upper is set to the smallest separator above the range
+    virtual Leaf<Key, Value, Less> * leaf_of(const Key & key, std::optional<Key> & upper) = 0;
 
-    virtual Node * push_erase(Node * root, Key key1, Key key2, Node * new_child) = 0;
+    virtual Node * push(Node * root, Key key, Node * new_child) = 0;
 
-    virtual std::tuple<Node *, Node &, std::size_t, bool> insert(Node * root, const std::pair<Key, Value> & value) = 0;
+    virtual std::tuple<Node *, Node &, std::size_t, bool> insert(Node * root, const slot_type & value) = 0;
 
-    virtual std::tuple<Node *, Node &, std::size_t, bool> insert_move(Node * root, std::pair<Key, Value> && value) = 0;
+    virtual std::tuple<Node *, Node &, std::size_t, bool> insert_move(Node * root, slot_type && value) = 0;
 
     virtual Node * split(Node * root) = 0;
 
-    virtual std::pair<Node *, Node *> merge(Node * root) = 0;
-
     virtual void print() = 0;
 
     virtual void new_parent(Inner_node<Key, Value, Less> * new_parent) = 0;
 
-    virtual std::tuple<iterator, Node *, Node *> erase(Node * root, const_iterator it) = 0;
-
-    virtual std::tuple<iterator, Node *, Node *> erase(Node * root, iterator it) = 0;
-
     size_t size = 0;
     Inner_node<Key, Value, Less> * parent = nullptr;
     Leaf<Key, Value, Less> * right = nullptr;
@@ -58,6 +123,46 @@ public:
             (BPTree<Key, Value, Less>::block_size - sizeof(size) - sizeof(parent) - sizeof(right)) /
             sizeof(std::pair<Key, Node *>);
     std::array<std::pair<Key, Node *>, max_size> data;
+
+private:
+    // Stored in front of every node, a cache line long so that nodes stay aligned in the arena
+    struct header
+    {
+        std::pmr::memory_resource * resource;
+        // bytes allocated, sizes are even so the lowest bit marks nodes of the node arena
+        std::size_t size;
+    };
+
+    static constexpr std::size_t in_arena = 1;
+
+    static constexpr std::size_t header_size = Node_arena::cache_line;
+
+    static const header & header_of(const void * node)
+    {
+        return *reinterpret_cast<const header *>(static_cast<const unsigned char *>(node) - header_size);
+    }
+
+    static void * allocate(const std::size_t size, std::pmr::memory_resource * source, const void * near)
+    {
+        const std::size_t total = size + header_size;
+        void * base = nullptr;
+        std::size_t tag = 0;
+        if (source != nullptr) {
+            base = source->allocate(total, header_size);
+        }
+        else {
+            const bool near_arena = near != nullptr && (header_of(near).size & in_arena) != 0;
+            base = Node_arena::instance().allocate(total, near_arena ? near : nullptr);
+            if (base != nullptr) {
+                tag = in_arena;
+            }
+            else {
+                base = ::operator new(total);
+            }
+        }
+        new (base) header{source, total | tag};
+        return static_cast<unsigned char *>(base) + header_size;
+    }
 };
 
 template <class Key, class Value, class Less>
@@ -67,6 +172,8 @@ class Leaf : public Node<Key, Value>
     using iterator = tree_iterator<Key, Value, Less, false>;
     using const_iterator = tree_iterator<Key, Value, Less, true>;
     using pair = std::pair<Node &, std::size_t>;
+    using slot = leaf_slot<Key, Value>;
+    using slot_type = typename slot::type;
 
 public:
     Leaf()
@@ -83,39 +190,44 @@ public:
 
     pair lower(const Key & key) override
     {
-        const auto it = std::lower_bound(data.begin(), data.begin() + size, key, [](const auto & ihs, const auto & rhs) {
-            return ihs.first < rhs;
-        });
-        const std::size_t i = it - data.begin();
-        if (i < size) {
-            return pair(*this, i);
-        }
-        return pair(*this, size);
+        return pair(*this, Node_search::bound<false, Less>(data, 0, size, key));
+    }
+
+    Leaf * leaf_of(const Key &, std::optional<Key> &) override
+    {
+        return this;
     }
 
     pair upper(const Key & key) override
     {
-        const auto it = std::upper_bound(data.begin(), data.begin() + size, key, [](const auto & ihs, const auto & rhs) {
-            return ihs < rhs.first;
-        });
-        const std::size_t i = it - data.begin();
-        if (i < size) {
-            return pair(*this, i);
-        }
-        return pair(*this, size);
+        return pair(*this, Node_search::bound<true, Less>(data, 0, size, key));
     }
 
-    auto & operator[](const std::size_t i) const
+    // Position of the first element not less than key, searching from slot 'from' on
+    std::size_t position(const Key & key, const std::size_t from = 0) const
     {
-        return data.at(i);
+        return Node_search::bound<false, Less>(data, from, size, key);
     }
 
-    auto & operator[](const std::size_t i)
+    // Starts loading the header and the first binary search probe of a leaf without touching it
+    static void prefetch(const Node * node)
     {
-        return data.at(i);
+        const auto * leaf = static_cast<const Leaf *>(node);
+        ::prefetch(&leaf->size);
+        ::prefetch(leaf->data.data() + max_size / 2);
     }
 
-    std::tuple<Node *, Node &, std::size_t, bool> insert(Node * root, const std::pair<Key, Value> & value) override
+    decltype(auto) operator[](const std::size_t i) const
+    {
+        return slot::get(data.at(i));
+    }
+
+    decltype(auto) operator[](const std::size_t i)
+    {
+        return slot::get(data.at(i));
+    }
+
+    std::tuple<Node *, Node &, std::size_t, bool> insert(Node * root, const slot_type & value) override
     {
         auto it = std::lower_bound(data.begin(), data.begin() + size, value, [](const auto & ihs, const auto & rhs) {
             return ihs.first < rhs.first;
@@ -162,7 +274,7 @@ public:
         }
     }
 
-    std::tuple<Node *, Node &, std::size_t, bool> insert_move(Node * root, std::pair<Key, Value> && value) override
+    std::tuple<Node *, Node &, std::size_t, bool> insert_move(Node * root, slot_type && value) override
     {
         auto it = std::lower_bound(data.begin(), data.begin() + size, value, [](const auto & ihs, const auto & rhs) {
             return ihs.first < rhs.first;
@@ -213,7 +325,7 @@ public:
     {
         const std::size_t size1 = size / 2;
         const std::size_t size2 = size - size1;
-        Leaf * leaf = new Leaf();
+        Leaf * leaf = new (near_hint{this}) Leaf();
         std::move(data.begin() + size1, data.end(), leaf->data.begin());
         leaf->size = size2;
         leaf->right = std::move(right);
@@ -224,172 +336,35 @@ public:
             root = parent->push(root, std::move(key), std::move(leaf));
         }
         else {
-            root = new Inner_node<Key, Value, Less>(this, std::move(key), std::move(leaf));
+            root = new (near_hint{this}) Inner_node<Key, Value, Less>(this, std::move(key), std::move(leaf));
         }
         return root;
     }
 
-    void replace_left(Key key, Node * node, Leaf * next, size_t level)
-    {
-        auto res = dynamic_cast<Inner_node<Key, Value, Less> *>(node);
-        if (res == nullptr) {
-            return;
-        }
-        const auto rend = std::make_reverse_iterator(res->data.begin());
-        const auto find = std::lower_bound(std::make_reverse_iterator(res->data.begin() + res->size), rend, key, [](const auto & lts, const auto & rhs) {
-            return lts.first > rhs;
-        });
-        if (find->first != res->data[0].first && find->first == key) {
-            if (level == 1) {
-                Leaf * leaf = dynamic_cast<Leaf *>((find + 1)->second);
-                if (leaf != nullptr) {
-                    leaf->right = next;
-                }
-            }
-            else {
-                replace_left(key, (find)->second, next, level - 1);
-            }
-        }
-        else {
-            if (node->parent != nullptr) {
-                replace_left(key, node->parent, next, level + 1);
-            }
-        }
-    }
-
-    std::tuple<iterator, Node *, Node *> erase_impl(Node * root, size_t pos)
+    // Removes the element in slot pos, rebalancing is left to the tree
+    void erase(const std::size_t pos)
     {
-        auto res_key = data[pos].first;
-        for (std::size_t i = pos; i < data.size() - 1; ++i) {
-            data[i] = data[i + 1];
-        }
+        std::move(data.begin() + pos + 1, data.begin() + size, data.begin() + pos);
         size--;
-
-        if (this == root) {
-            return {iterator(*this, pos), root, nullptr};
-        }
-
-        if (size == 0) {
-            replace_left(res_key, parent, right, 1);
-            auto res1 = iterator();
-            if (right != nullptr) {
-                res1 = iterator(*right, pos);
-            }
-            right = nullptr;
-            auto res2 = parent->push_erase(root, data[pos].first, res_key, nullptr);
-            std::tuple<iterator, Node *, Node *> res = {res1, res2, this};
-            return res;
-        }
-
-        if (size >= max_size / 2) {
-            return {iterator(*this, pos), root, nullptr};
-        }
-        else {
-            std::pair<Node *, Node *> res = merge(root);
-            return {iterator(*this, pos), res.first, res.second};
-        }
     }
 
-    std::tuple<iterator, Node *, Node *> erase(Node * root, const_iterator it) override
+    // Merges sorted slots whose keys are not in the leaf yet, all of them have to fit
+    template <class It>
+    void merge_sorted(const It first, It last)
     {
-        return erase_impl(root, it.position());
-    }
-
-    std::tuple<iterator, Node *, Node *> erase(Node * root, iterator it) override
-    {
-        return erase_impl(root, it.position());
-    }
-
-    Node * push_erase(Node * root, Key key1, Key key2, Node * new_child) override
-    {
-        return parent->push_erase(root, key1, key2, new_child);
-    }
-
-    std::pair<Node *, Node *> merge(Node * root) override
-    {
-        Node * deleted = nullptr;
-        if (right != nullptr) {
-            Leaf * node1 = dynamic_cast<Leaf *>(right);
-            if (size + node1->size >= max_size) {
-                std::size_t new_size = (size + node1->size) / 2;
-                std::size_t rest_size = (size + node1->size) - new_size;
-
-                auto key2 = node1->data[0].first;
-
-                if (new_size > size) {
-                    std::move(node1->data.begin(), node1->data.begin() + (new_size - size), data.begin() + size);
-                    std::move(node1->data.begin() + (new_size - size), node1->data.end(), node1->data.begin());
-                }
-                else {
-                    std::move(node1->data.begin(), node1->data.begin() + node1->size, node1->data.begin() + (new_size - node1->size));
-                    std::move(data.begin(), data.begin() + (new_size - node1->size), node1->data.begin());
-                }
-
-                auto res = parent;
-                while (res != nullptr) {
-                    auto it2 = std::lower_bound(res->data.begin(), res->data.begin() + res->size, key2, [](const auto & ihs, const auto & rhs) {
-                        return ihs.first < rhs;
-                    });
-
-                    it2->first = node1->data[0].first;
-
-                    if (it2 - res->data.begin() == 0) {
-                        res = res->parent;
-                    }
-                    else {
-                        res = nullptr;
-                    }
-                }
-
-                size = new_size;
-                node1->size = rest_size;
-            }
-            else {
-                auto i = size + 1;
-                if (size > node1->size) {
-                    i = size - node1->size + 1;
-                }
-                std::copy(node1->data.begin(), node1->data.begin() + node1->size, data.begin() + size);
-                size += node1->size;
-                right = node1->right;
-                deleted = node1;
-
-                if (parent != nullptr && parent == root &&
-                    parent->size == 1) {
-                    return {root, deleted};
-                }
-
-                root = parent->push_erase(root, data[i].first, data[i].first, nullptr);
-
-                if (size < max_size / 2) {
-                    std::pair<Node *, Node *> res = merge(root);
-                    root = res.first;
-                    deleted = res.second;
-                }
-                return {root, deleted};
-            }
-        }
-        else {
-            if (parent != nullptr && parent == root &&
-                parent->size == 1) {
-                return {root, deleted};
-            }
-
-            if (parent != nullptr) {
-                auto res = parent;
-                if (res->size > 1) {
-                    const auto rend = std::make_reverse_iterator(res->data.begin());
-                    const auto it2 = std::lower_bound(std::make_reverse_iterator(res->data.begin() + res->size), rend, data[0], [](const auto & lts, const auto & rhs) {
-                        return lts.first > rhs.first;
-                    });
-                    root = parent->push_erase(root, data[0].first, data[0].first, nullptr);
-                    std::pair<Node *, Node *> res2 = (it2 + 1)->second->merge(root);
-                    root = res2.first;
-                    deleted = res2.second;
-                }
-            }
+        auto in = data.begin() + size;
+        auto out = in + std::distance(first, last);
+        size += std::distance(first, last);
+        // from the back, every slot shifts the block of keys greater than it in one move
+        while (last != first) {
+            --last;
+            const auto from = std::upper_bound(data.begin(), in, last->first, [](const auto & lhs, const auto & rhs) {
+                return lhs < rhs.first;
+            });
+            out = std::move_backward(from, in, out);
+            in = from;
+            *--out = std::move(*last);
         }
-        return {root, deleted};
     }
 
     void print() override
@@ -410,8 +385,9 @@ public:
     Leaf<Key, Value, Less> * right = nullptr;
     static constexpr std::size_t max_size =
             (BPTree<Key, Value, Less>::block_size - sizeof(size) - sizeof(parent) - sizeof(right)) /
-            sizeof(std::pair<Key, Value>);
-    std::array<std::pair<Key, Value>, max_size> data;
+            sizeof(slot_type);
+    static_assert(max_size >= 4, "key is too big for a leaf block");
+    std::array<slot_type, max_size> data;
 };
 
 template <class Key, class Value, class Less = std::less<Key>>
@@ -457,29 +433,37 @@ public:
 
     std::pair<Node &, std::size_t> lower(const Key & key) override
     {
-        const auto rend = std::make_reverse_iterator(data.begin());
-        const auto it = std::lower_bound(std::make_reverse_iterator(data.begin() + size), rend, key, [](const auto & lts, const auto & rhs) {
-            return lts.first > rhs;
-        });
-        if (it != rend) {
-            return it->second->lower(key);
+        return data[child_index(key)].second->lower(key);
+    }
+
+    Leaf<Key, Value, Less> * leaf_of(const Key & key, std::optional<Key> & upper) override
+    {
+        const std::size_t k = child_index(key);
+        if (k + 1 < size) {
+            upper = data[k + 1].first;
         }
-        return data.at(0).second->lower(key);
+        return data[k].second->leaf_of(key, upper);
     }
 
     std::pair<Node &, std::size_t> upper(const Key & key) override
     {
-        const auto rend = std::make_reverse_iterator(data.begin());
-        const auto it = std::lower_bound(std::make_reverse_iterator(data.begin() + size), rend, key, [](const auto & lts, const auto & rhs) {
-            return lts.first > rhs;
-        });
-        if (it != rend) {
-            return it->second->upper(key);
-        }
-        return data.at(0).second->upper(key);
+        return data[child_index(key)].second->upper(key);
+    }
+
+    // Slot of the child whose subtree may hold key, searching from slot 'from' on
+    std::size_t child_index(const Key & key, const std::size_t from = 0) const
+    {
+        return Node_search::bound<true, Less>(data, std::max<std::size_t>(from, 1), size, key) - 1;
+    }
+
+    static void prefetch(const Node * node)
+    {
+        const auto * inner = static_cast<const Inner_node *>(node);
+        ::prefetch(&inner->size);
+        ::prefetch(inner->data.data() + max_size / 2);
     }
 
-    std::tuple<Node *, Node &, std::size_t, bool> insert(Node * root, const std::pair<Key, Value> & value) override
+    std::tuple<Node *, Node &, std::size_t, bool> insert(Node * root, const typename Node::slot_type & value) override
     {
         const auto rend = std::make_reverse_iterator(data.begin());
         const auto it = std::lower_bound(std::make_reverse_iterator(data.begin() + size), rend, value, [](const auto & lts, const auto & rhs) {
@@ -491,7 +475,7 @@ public:
         return data[0].second->insert(root, value);
     }
 
-    std::tuple<Node *, Node &, std::size_t, bool> insert_move(Node * root, std::pair<Key, Value> && value) override
+    std::tuple<Node *, Node &, std::size_t, bool> insert_move(Node * root, typename Node::slot_type && value) override
     {
         const auto rend = std::make_reverse_iterator(data.begin());
         const auto it = std::lower_bound(std::make_reverse_iterator(data.begin() + size), rend, value, [](const auto & lts, const auto & rhs) {
@@ -507,19 +491,23 @@ public:
     {
         const std::size_t new_size = size / 2;
         const std::size_t rest_size = size - new_size;
-        auto * new_node = new Inner_node(rest_size, std::move(data[new_size].second));
+        auto * new_node = new (near_hint{this}) Inner_node(rest_size, std::move(data[new_size].second));
         Key split_key = data[new_size].first;
-        std::move(data.begin() + new_size, data.end(), new_node->data.begin());
-        for (auto i = data.begin() + new_size; i != data.end(); i++) {
+        std::move(data.begin() + new_size, data.begin() + size, new_node->data.begin());
+        for (auto i = data.begin() + new_size; i != data.begin() + size; i++) {
             i->second->new_parent(new_node);
         }
         size = new_size;
+        if (buffer != nullptr && !buffer->empty()) {
+            new_node->buffer = std::make_unique<Message_buffer<Key, Value>>();
+            buffer->split(split_key, *new_node->buffer);
+        }
 
         if (parent != nullptr) {
             root = parent->push(root, split_key, std::move(new_node));
         }
         else {
-            root = new Inner_node(this, split_key, std::move(new_node));
+            root = new (near_hint{this}) Inner_node(this, split_key, std::move(new_node));
         }
         return root;
     }
@@ -544,50 +532,6 @@ public:
         }
     }
 
-    Node * push_erase(Node * root, Key key1, Key key2, Node * new_child) override
-    {
-        if (new_child == nullptr) {
-            const auto it2 = std::lower_bound(data.begin(), data.begin() + size, key1, [](const auto & ihs, const auto & rhs) {
-                return ihs.first < rhs;
-            });
-
-            size--;
-            if (size != 0) {
-                std::move(it2, data.end(), it2 - 1);
-            }
-            else {
-                return root;
-            }
-            if (size < max_size / 2) {
-                std::pair<Node *, Node *> res2 = merge(root);
-                root = res2.first;
-            }
-            if (this != root && parent != nullptr) {
-                return parent->push_erase(root, key1, key2, new_child);
-            }
-        }
-        else {
-            const auto it2 = std::lower_bound(data.begin(), data.begin() + size, key1, [](const auto & ihs, const auto & rhs) {
-                return ihs.first < rhs;
-            });
-
-            size--;
-            it2->second = new_child;
-            if (size != 0) {
-                std::move(it2, data.end(), it2 - 1);
-            }
-            (it2 - 1)->first = key2;
-            if (size < max_size / 2) {
-                std::pair<Node *, Node *> res2 = merge(root);
-                root = res2.first;
-            }
-            if (parent != nullptr) {
-                return parent->push_erase(root, key1, key2, new_child);
-            }
-        }
-        return root;
-    }
-
     void print() override
     {
         std::cout << "inner ---------------- size: " << size << std::endl;
@@ -601,162 +545,130 @@ public:
         std::cout << " --------------- end" << std::endl;
     }
 
-    std::tuple<iterator, Node *, Node *> erase(Node * root, const_iterator it) override
+    void new_parent(Inner_node<Key, Value, Less> * new_parent) override
     {
-        const auto rend = std::make_reverse_iterator(data.begin());
-        const auto res = std::lower_bound(std::make_reverse_iterator(data.begin() + size), rend, *it, [](const auto & lts, const auto & rhs) {
-            return lts.first > rhs.first;
-        });
-        if (res != rend) {
-            return res->second->erase(root, it);
-        }
-        return data[size - 1].second->erase(root, it);
+        this->parent = new_parent;
     }
 
-    std::tuple<iterator, Node *, Node *> erase(Node * root, iterator it) override
+    std::size_t index_of(const Node * child) const
     {
-        const auto rend = std::make_reverse_iterator(data.begin());
-        const auto res = std::lower_bound(std::make_reverse_iterator(data.begin() + size), rend, *it, [](const auto & lts, const auto & rhs) {
-            return lts.first > rhs.first;
-        });
-        if (res != rend) {
-            return res->second->erase(root, it);
-        }
-        return data[size - 1].second->erase(root, it);
+        return std::find_if(data.begin(), data.begin() + size, [child](const auto & item) {
+                   return item.second == child;
+               }) -
+                data.begin();
     }
 
-    Node * find_left_or_right(Key key, Node * node, size_t level, bool left)
+    void remove(const std::size_t i)
     {
-        auto res = dynamic_cast<Inner_node<Key, Value, Less> *>(node);
-        if (res == nullptr) {
-            return nullptr;
-        }
-        const auto rend = std::make_reverse_iterator(res->data.begin());
-        const auto find = std::lower_bound(std::make_reverse_iterator(res->data.begin() + res->size), rend, key, [](const auto & lts, const auto & rhs) {
-            return lts.first > rhs;
-        });
-        if (find->first != res->data[0].first && find->first == key) {
-            if (level == 1) {
-                Node * left_node;
-                if (left) {
-                    left_node = (find + 1)->second;
-                }
-                else {
-                    left_node = (find - 1)->second;
-                }
-                return left_node;
-            }
-            else {
-                find_left_or_right(key, (find)->second, level - 1, left);
-            }
-        }
-        else {
-            if (node->parent != nullptr) {
-                find_left_or_right(key, node->parent, level + 1, left);
-            }
-        }
-        return nullptr;
+        std::move(data.begin() + i + 1, data.begin() + size, data.begin() + i);
+        size--;
     }
 
-    std::pair<Node *, Node *> merge(Node * root) override
+    // Evens out the children in slots k and k + 1: the right one is merged into the left one when
+    // both fit into a single node, otherwise entries are moved so that both are at least half full.
+    // Returns the child that was merged away, if any
+    Node * balance(const std::size_t k)
     {
-        Node * deleted = nullptr;
-        Node * new_node = find_left_or_right(data[0].first, parent, 1, true);
-        if (new_node == nullptr) {
-            new_node = find_left_or_right(data[0].first, parent, 1, false);
+        auto * leaf = dynamic_cast<Leaf<Key, Value, Less> *>(data[k].second);
+        if (leaf != nullptr) {
+            return balance(k, leaf, static_cast<Leaf<Key, Value, Less> *>(data[k + 1].second));
         }
+        return balance(k, static_cast<Inner_node *>(data[k].second), static_cast<Inner_node *>(data[k + 1].second));
+    }
 
-        if (new_node != nullptr) {
-            auto * node1 = dynamic_cast<Inner_node *>(new_node);
-            if (size + node1->size >= max_size) {
-                std::size_t new_size = (size + node1->size) / 2;
-                std::size_t rest_size = (size + node1->size) - new_size;
-
-                auto key2 = node1->data[0].first;
-
-                if (new_size > size) {
-                    std::move(node1->data.begin(), node1->data.begin() + (new_size - size), data.begin() + size);
-                    std::move(node1->data.begin() + (new_size - size), node1->data.end(), node1->data.begin());
-                }
-                else {
-                    std::move(node1->data.begin(), node1->data.begin() + node1->size, node1->data.begin() + (new_size - node1->size));
-                    std::move(data.begin(), data.begin() + (new_size - node1->size), node1->data.begin());
-                }
-
-                auto res = parent;
-                while (res != nullptr) {
-                    auto it2 = std::lower_bound(res->data.begin(), res->data.begin() + res->size, key2, [](const auto & ihs, const auto & rhs) {
-                        return ihs.first < rhs;
-                    });
-
-                    it2->first = node1->data[0].first;
-
-                    if (it2 - res->data.begin() == 0) {
-                        res = res->parent;
-                    }
-                    else {
-                        res = nullptr;
-                    }
-                }
+    std::size_t size;
+    Inner_node<Key, Value, Less> * parent = nullptr;
+    // Pending updates for the subtree, only allocated in buffered mode
+    std::unique_ptr<Message_buffer<Key, Value>> buffer;
+    static constexpr std::size_t max_size =
+            (BPTree<Key, Value, Less>::block_size - sizeof(size) - sizeof(parent) - sizeof(buffer)) /
+            sizeof(std::pair<Key, Node *>);
+    static_assert(max_size >= 4, "key is too big for an inner block");
+    std::array<std::pair<Key, Node *>, max_size> data;
+private:
+    Node * balance(const std::size_t k, Leaf<Key, Value, Less> * left, Leaf<Key, Value, Less> * right)
+    {
+        const std::size_t total = left->size + right->size;
+        if (total < Leaf<Key, Value, Less>::max_size) {
+            std::move(right->data.begin(), right->data.begin() + right->size, left->data.begin() + left->size);
+            left->size = total;
+            right->size = 0;
+            left->right = right->right;
+            remove(k + 1);
+            return right;
+        }
+        const std::size_t new_size = total / 2;
+        if (left->size > new_size) {
+            const std::size_t moved = left->size - new_size;
+            std::move_backward(right->data.begin(), right->data.begin() + right->size, right->data.begin() + right->size + moved);
+            std::move(left->data.begin() + new_size, left->data.begin() + left->size, right->data.begin());
+        }
+        else if (left->size < new_size) {
+            // an even split already is left alone, shifting by nothing would move the keys onto themselves
+            const std::size_t moved = new_size - left->size;
+            std::move(right->data.begin(), right->data.begin() + moved, left->data.begin() + left->size);
+            std::move(right->data.begin() + moved, right->data.begin() + right->size, right->data.begin());
+        }
+        left->size = new_size;
+        right->size = total - new_size;
+        data[k + 1].first = right->data[0].first;
+        return nullptr;
+    }
 
-                size = new_size;
-                node1->size = rest_size;
+    Node * balance(const std::size_t k, Inner_node * left, Inner_node * right)
+    {
+        const std::size_t total = left->size + right->size;
+        right->data[0].first = data[k + 1].first;
+        if (total < max_size) {
+            std::move(right->data.begin(), right->data.begin() + right->size, left->data.begin() + left->size);
+            for (std::size_t i = left->size; i < total; ++i) {
+                left->data[i].second->new_parent(left);
             }
-            else {
-                auto i = size;
-                if (size > node1->size) {
-                    i = size - node1->size;
-                }
-                std::copy(node1->data.begin(), node1->data.begin() + node1->size, data.begin() + size);
-                size += node1->size;
-                deleted = node1;
-
-                if (parent != nullptr && parent == root &&
-                    parent->size == 1) {
-                    return {root, deleted};
-                }
-
-                root = parent->push_erase(root, data[i].first, data[i].first, nullptr);
-
-                if (size < max_size / 2) {
-                    std::pair<Node *, Node *> res = merge(root);
-                    root = res.first;
-                    deleted = res.second;
-                }
-                return {root, deleted};
+            left->size = total;
+            right->size = 0;
+            remove(k + 1);
+            move_buffer(right, left);
+            return right;
+        }
+        const std::size_t new_size = total / 2;
+        if (left->size > new_size) {
+            const std::size_t moved = left->size - new_size;
+            std::move_backward(right->data.begin(), right->data.begin() + right->size, right->data.begin() + right->size + moved);
+            std::move(left->data.begin() + new_size, left->data.begin() + left->size, right->data.begin());
+            for (std::size_t i = 0; i < moved; ++i) {
+                right->data[i].second->new_parent(right);
             }
         }
-        else {
-            if (parent != nullptr && parent == root &&
-                parent->size == 1) {
-                return {root, deleted};
-            }
-
-            if (parent != nullptr) {
-                auto res = parent;
-                if (res->size > 1) {
-                    const auto rend = std::make_reverse_iterator(res->data.begin());
-                    const auto it2 = std::lower_bound(std::make_reverse_iterator(res->data.begin() + res->size), rend, data[0], [](const auto & lts, const auto & rhs) {
-                        return lts.first > rhs.first;
-                    });
-                    root = parent->push_erase(root, data[0].first, data[0].first, nullptr);
-                    std::pair<Node *, Node *> res2 = (it2 + 1)->second->merge(root);
-                    root = res2.first;
-                    deleted = res2.second;
-                }
+        else if (left->size < new_size) {
+            const std::size_t moved = new_size - left->size;
+            std::move(right->data.begin(), right->data.begin() + moved, left->data.begin() + left->size);
+            std::move(right->data.begin() + moved, right->data.begin() + right->size, right->data.begin());
+            for (std::size_t i = left->size; i < new_size; ++i) {
+                left->data[i].second->new_parent(left);
             }
         }
-        return {root, deleted};
+        left->size = new_size;
+        right->size = total - new_size;
+        data[k + 1].first = right->data[0].first;
+        if ((left->buffer != nullptr && !left->buffer->empty()) || (right->buffer != nullptr && !right->buffer->empty())) {
+            move_buffer(right, left);
+            right->buffer = std::make_unique<Message_buffer<Key, Value>>();
+            left->buffer->split(data[k + 1].first, *right->buffer);
+        }
+        return nullptr;
     }
 
-    void new_parent(Inner_node<Key, Value, Less> * new_parent) override
+    // Moves the pending updates of a sibling, their keys are disjoint from the ones of 'to'
+    static void move_buffer(Inner_node * from, Inner_node * to)
     {
-        this->parent = new_parent;
+        if (from->buffer == nullptr || from->buffer->empty()) {
+            return;
+        }
+        if (to->buffer == nullptr) {
+            to->buffer = std::move(from->buffer);
+        }
+        else {
+            to->buffer->add(std::move(*from->buffer));
+        }
     }
-
-    std::size_t size;
-    Inner_node<Key, Value, Less> * parent = nullptr;
-    static constexpr std::size_t max_size =
-            (BPTree<Key, Value, Less>::block_size - sizeof(size) - sizeof(parent)) / sizeof(std::pair<Key, Node *>);
-    std::array<std::pair<Key, Node *>, max_size> data;
 };
\ No newline at end of file
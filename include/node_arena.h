@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Placement argument of node allocations: the new node goes next to the given one if possible
+struct near_hint
+{
+    const void * node;
+};
+
+// Process-wide storage for tree nodes carved out of 2 MiB regions. A region is mapped with
+// explicit huge pages when the system has them reserved, otherwise it is aligned to 2 MiB and
+// advised for transparent huge pages, so neighbouring nodes share one TLB entry. Every region
+// holds nodes of a single size and starts with a pointer to its bookkeeping, so a free finds
+// the region without a search. Freed nodes are reused, regions stay mapped until a trim finds
+// them empty
+class Node_arena
+{
+public:
+    static constexpr std::size_t region_size = std::size_t(2) << 20;
+    static constexpr std::size_t small_page_size = 4096;
+    static constexpr std::size_t cache_line = 64;
+
+    struct report
+    {
+        std::size_t regions = 0;
+        // regions mapped with MAP_HUGETLB
+        std::size_t hugetlb_regions = 0;
+        // bytes of the other regions the kernel currently backs with transparent huge pages
+        std::size_t transparent_huge_bytes = 0;
+        std::size_t mapped_bytes = 0;
+        std::size_t used_bytes = 0;
+
+        std::size_t huge_bytes() const
+        {
+            return hugetlb_regions * region_size + transparent_huge_bytes;
+        }
+
+        // Share of the mapped bytes translated by 2 MiB page table entries
+        double coverage() const
+        {
+            return mapped_bytes == 0 ? 0.0 : static_cast<double>(huge_bytes()) / mapped_bytes;
+        }
+
+        // Page table entries needed to map all regions
+        std::size_t page_table_entries() const
+        {
+            return huge_bytes() / region_size + (mapped_bytes - huge_bytes()) / small_page_size;
+        }
+    };
+
+    static Node_arena & instance()
+    {
+        static Node_arena res;
+        return res;
+    }
+
+    Node_arena(const Node_arena &) = delete;
+
+    Node_arena & operator=(const Node_arena &) = delete;
+
+    // Nodes allocated while the arena is disabled come from the global heap. The flag is read
+    // without the lock, an allocation racing with a switch may still land in the arena
+    void enable(const bool value)
+    {
+        active.store(value, std::memory_order_relaxed);
+    }
+
+    bool enabled() const
+    {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    // nullptr when the arena is disabled or the size does not fit a region. Slots start on cache
+    // line boundaries. near has to be memory of the arena
+    void * allocate(const std::size_t size, const void * near = nullptr)
+    {
+        const std::size_t slot = align(size, cache_line);
+        if (!active.load(std::memory_order_relaxed) || slot > region_size - cache_line) {
+            return nullptr;
+        }
+        std::lock_guard lock(mutex);
+        if (near != nullptr) {
+            region & r = region_of(near);
+            if (r.slot == slot && has_room(r)) {
+                return take(r);
+            }
+        }
+        auto & open = pools[slot];
+        while (!open.empty() && !has_room(regions[open.back()])) {
+            regions[open.back()].listed = false;
+            open.pop_back();
+        }
+        if (open.empty()) {
+            open.push_back(map_region(slot));
+        }
+        return take(regions[open.back()]);
+    }
+
+    // p has to come from allocate, the arena may have been disabled since
+    void deallocate(void * p)
+    {
+        std::lock_guard lock(mutex);
+        region & r = region_of(p);
+        r.free.push_back(p);
+        r.live--;
+        if (!r.listed) {
+            r.listed = true;
+            pools[r.slot].push_back(key_of(p));
+        }
+    }
+
+    // Unmaps the regions without live nodes, returns the number of bytes given back
+    std::size_t trim()
+    {
+        std::lock_guard lock(mutex);
+        std::size_t res = 0;
+        for (auto it = regions.begin(); it != regions.end();) {
+            if (it->second.live != 0) {
+                ++it;
+                continue;
+            }
+            auto & open = pools[it->second.slot];
+            open.erase(std::remove(open.begin(), open.end(), it->first), open.end());
+#if defined(__linux__)
+            munmap(it->second.base, region_size);
+#else
+            ::operator delete(it->second.base, std::align_val_t(region_size));
+#endif
+            res += region_size;
+            it = regions.erase(it);
+        }
+        return res;
+    }
+
+    report stats() const
+    {
+        std::lock_guard lock(mutex);
+        report res;
+        res.regions = regions.size();
+        res.mapped_bytes = regions.size() * region_size;
+        for (const auto & [base, r] : regions) {
+            res.hugetlb_regions += r.hugetlb ? 1 : 0;
+            res.used_bytes += r.live * r.slot;
+        }
+        res.transparent_huge_bytes = transparent_huge_bytes();
+        return res;
+    }
+
+private:
+    struct region
+    {
+        unsigned char * base = nullptr;
+        std::size_t slot = 0;
+        std::size_t bump = 0;
+        std::size_t live = 0;
+        std::vector<void *> free;
+        bool hugetlb = false;
+        // whether the region is in the open list of its pool
+        bool listed = true;
+    };
+
+    Node_arena() = default;
+
+    static constexpr std::size_t align(const std::size_t n, const std::size_t to)
+    {
+        return (n + to - 1) / to * to;
+    }
+
+    static std::uintptr_t key_of(const void * p)
+    {
+        return reinterpret_cast<std::uintptr_t>(p) & ~(region_size - 1);
+    }
+
+    static region & region_of(const void * p)
+    {
+        return **reinterpret_cast<region * const *>(key_of(p));
+    }
+
+    static bool has_room(const region & r)
+    {
+        return !r.free.empty() || r.bump + r.slot <= region_size;
+    }
+
+    static void * take(region & r)
+    {
+        r.live++;
+        if (!r.free.empty()) {
+            void * res = r.free.back();
+            r.free.pop_back();
+            return res;
+        }
+        void * res = r.base + r.bump;
+        r.bump += r.slot;
+        return res;
+    }
+
+    std::uintptr_t map_region(const std::size_t slot)
+    {
+        region r;
+        r.slot = slot;
+        // the first cache line holds the back pointer
+        r.bump = cache_line;
+#if defined(__linux__)
+        void * p = mmap(nullptr, region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            r.base = static_cast<unsigned char *>(p);
+            r.hugetlb = true;
+        }
+        else {
+            // over-allocate to cut out a 2 MiB aligned range, which THP can back with one page
+            p = mmap(nullptr, 2 * region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            const auto start = reinterpret_cast<std::uintptr_t>(p);
+            const auto aligned = align(start, region_size);
+            if (aligned > start) {
+                munmap(p, aligned - start);
+            }
+            munmap(reinterpret_cast<void *>(aligned + region_size), start + region_size - aligned);
+            r.base = reinterpret_cast<unsigned char *>(aligned);
+            madvise(r.base, region_size, MADV_HUGEPAGE);
+        }
+#else
+        r.base = static_cast<unsigned char *>(::operator new(region_size, std::align_val_t(region_size)));
+#endif
+        const auto res = reinterpret_cast<std::uintptr_t>(r.base);
+        region * added = &regions.emplace(res, std::move(r)).first->second;
+        *reinterpret_cast<region **>(added->base) = added;
+        return res;
+    }
+
+    // Sums AnonHugePages of the mappings in /proc/self/smaps, weighted by their overlap with the
+    // regions which are not backed by explicit huge pages
+    std::size_t transparent_huge_bytes() const
+    {
+        std::ifstream smaps("/proc/self/smaps");
+        std::size_t res = 0;
+        std::size_t overlap = 0;
+        std::size_t length = 0;
+        std::string line;
+        while (std::getline(smaps, line)) {
+            std::uintptr_t from = 0;
+            std::uintptr_t to = 0;
+            char dash = 0;
+            std::istringstream header(line);
+            if (header >> std::hex >> from >> dash >> to && dash == '-') {
+                length = to - from;
+                overlap = 0;
+                for (auto it = regions.lower_bound(key_of(reinterpret_cast<const void *>(from))); it != regions.end() && it->first < to; ++it) {
+                    if (!it->second.hugetlb && it->first >= from) {
+                        overlap += std::min<std::uintptr_t>(it->first + region_size, to) - it->first;
+                    }
+                }
+                continue;
+            }
+            std::istringstream field(line);
+            std::string name;
+            std::size_t kb = 0;
+            if (overlap > 0 && field >> name >> kb && name == "AnonHugePages:") {
+                res += kb * 1024 * overlap / length;
+            }
+        }
+        return res;
+    }
+
+    mutable std::mutex mutex;
+    std::atomic<bool> active{false};
+    std::map<std::uintptr_t, region> regions;
+    // regions with room, per slot size
+    std::map<std::size_t, std::vector<std::uintptr_t>> pools;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+
+enum class Search
+{
+    binary,
+    // interpolation between the first and the last key of the searched range, for arithmetic keys
+    interpolation,
+};
+
+// Search for a key inside of a node. The process-wide policy applies to trees with arithmetic keys
+// ordered by std::less, other trees always search binary. Interpolation probes the position the key
+// would have if the keys of the node were evenly spread, narrows the range to one side of the probe
+// and guesses again a few times before it finishes binary, so skewed keys cost at most a few extra
+// probes. Probes are only counted while counting is on
+class Node_search
+{
+public:
+    struct report
+    {
+        std::size_t searches = 0;
+        // keys compared
+        std::size_t probes = 0;
+
+        double probes_per_search() const
+        {
+            return searches == 0 ? 0.0 : static_cast<double>(probes) / searches;
+        }
+    };
+
+    static void use(const Search value)
+    {
+        policy.store(value, std::memory_order_relaxed);
+    }
+
+    static Search used()
+    {
+        return policy.load(std::memory_order_relaxed);
+    }
+
+    static void count(const bool value)
+    {
+        counting.store(value, std::memory_order_relaxed);
+    }
+
+    static report stats()
+    {
+        report res;
+        res.searches = searches.load(std::memory_order_relaxed);
+        res.probes = probes.load(std::memory_order_relaxed);
+        return res;
+    }
+
+    static void reset_stats()
+    {
+        searches.store(0, std::memory_order_relaxed);
+        probes.store(0, std::memory_order_relaxed);
+    }
+
+    // Index of the first slot in [from, to) whose key is not less than key, or with upper the
+    // first one whose key is greater
+    template <bool upper, class Less, class Array, class Key>
+    static std::size_t bound(const Array & data, const std::size_t from, const std::size_t to, const Key & key)
+    {
+        const auto before = [&key](const std::size_t i, const auto & data) {
+            if constexpr (upper) {
+                return !(key < data[i].first);
+            }
+            else {
+                return data[i].first < key;
+            }
+        };
+        std::size_t probed = 0;
+        std::size_t res;
+        if constexpr (std::is_arithmetic_v<Key> && std::is_same_v<Less, std::less<Key>>) {
+            if (used() == Search::interpolation) {
+                res = interpolate(data, from, to, key, before, probed);
+            }
+            else {
+                res = binary(data, from, to, before, probed);
+            }
+        }
+        else {
+            res = binary(data, from, to, before, probed);
+        }
+        if (counting.load(std::memory_order_relaxed)) {
+            searches.fetch_add(1, std::memory_order_relaxed);
+            probes.fetch_add(probed, std::memory_order_relaxed);
+        }
+        return res;
+    }
+
+private:
+    // Ranges this short are searched binary, as is what is left after max_rounds guesses
+    static constexpr std::size_t min_interpolated = 8;
+    static constexpr std::size_t max_rounds = 3;
+
+    // First index in [lo, hi) which is not before the key
+    template <class Array, class Before>
+    static std::size_t binary(const Array & data, std::size_t lo, std::size_t hi, const Before & before, std::size_t & probed)
+    {
+        while (lo < hi) {
+            const std::size_t mid = lo + (hi - lo) / 2;
+            probed++;
+            if (before(mid, data)) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    template <class Array, class Key, class Before>
+    static std::size_t interpolate(const Array & data, std::size_t lo, std::size_t hi, const Key & key, const Before & before, std::size_t & probed)
+    {
+        // the result is in [lo, hi], the keys around that range are estimated by the bounds of the
+        // node until a probe narrows it
+        double low = lo < hi ? static_cast<double>(data[lo].first) : 0.0;
+        double high = lo < hi ? static_cast<double>(data[hi - 1].first) : 0.0;
+        for (std::size_t round = 0; round < max_rounds && hi - lo >= min_interpolated; ++round) {
+            const double share = high > low ? (static_cast<double>(key) - low) / (high - low) : 0.5;
+            const std::size_t guess = lo + static_cast<std::size_t>(std::clamp(share, 0.0, 1.0) * static_cast<double>(hi - lo - 1));
+            probed++;
+            if (before(guess, data)) {
+                lo = guess + 1;
+                low = static_cast<double>(data[guess].first);
+            }
+            else {
+                hi = guess;
+                high = static_cast<double>(data[guess].first);
+            }
+        }
+        return binary(data, lo, hi, before, probed);
+    }
+
+    static inline std::atomic<Search> policy{Search::binary};
+    static inline std::atomic<bool> counting{false};
+    static inline std::atomic<std::size_t> searches{0};
+    static inline std::atomic<std::size_t> probes{0};
+};
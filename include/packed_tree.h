@@ -0,0 +1,376 @@
+#pragma once
+
+#include "bptree.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Leaf block in frame-of-reference encoding: the keys are stored as bit-packed deltas from the
+// smallest key of the block, the values as a separate column after them. Dense integer keys
+// need only a few bits each, so far more entries fit into a block than as std::pair slots
+template <class Key, class Value>
+class Packed_leaf
+{
+    static_assert(std::is_integral_v<Key>, "packed leaves need integral keys");
+    static_assert(std::is_trivially_copyable_v<Value>, "packed leaves need trivially copyable values");
+
+    using word = std::uint64_t;
+    using delta = std::make_unsigned_t<Key>;
+
+public:
+    static constexpr std::size_t block_size = BPTree<Key, Value>::block_size;
+
+    // Encodes the longest prefix of the sorted range which fits into one block, returns its end
+    template <class It>
+    It assign(const It begin, const It end)
+    {
+        base = begin->first;
+        width = 0;
+        count = 0;
+        It last = begin;
+        for (; last != end; ++last) {
+            const auto needed = bits(static_cast<delta>(last->first) - static_cast<delta>(base));
+            if (!fits(count + 1, std::max(width, needed))) {
+                break;
+            }
+            width = std::max(width, needed);
+            count++;
+        }
+        values_offset = static_cast<std::uint16_t>(align(words(count, width) * sizeof(word), alignof(Value)));
+        std::fill(std::begin(payload), std::end(payload), 0);
+        std::size_t i = 0;
+        for (It j = begin; j != last; ++j, ++i) {
+            store_key(i, static_cast<delta>(j->first) - static_cast<delta>(base));
+            std::memcpy(payload + values_offset + i * sizeof(Value), &j->second, sizeof(Value));
+        }
+        return last;
+    }
+
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    Key key(const std::size_t i) const
+    {
+        return static_cast<Key>(static_cast<delta>(base) + load_key(i));
+    }
+
+    Value value(const std::size_t i) const
+    {
+        Value res;
+        std::memcpy(&res, payload + values_offset + i * sizeof(Value), sizeof(Value));
+        return res;
+    }
+
+    // Index of the first key not less than key, decoding only the probed deltas
+    std::size_t position(const Key & key) const
+    {
+        if (key < base) {
+            return 0;
+        }
+        const delta target = static_cast<delta>(key) - static_cast<delta>(base);
+        std::size_t first = 0;
+        std::size_t n = count;
+        while (n > 0) {
+            const std::size_t half = n / 2;
+            if (load_key(first + half) < target) {
+                first += half + 1;
+                n -= half + 1;
+            }
+            else {
+                n = half;
+            }
+        }
+        return first;
+    }
+
+private:
+    static constexpr std::size_t header_size = sizeof(Key) + sizeof(std::uint16_t) * 2 + sizeof(std::uint8_t);
+    static constexpr std::size_t payload_size =
+            block_size - (header_size + alignof(word) - 1) / alignof(word) * alignof(word);
+
+    static constexpr std::size_t align(const std::size_t n, const std::size_t to)
+    {
+        return (n + to - 1) / to * to;
+    }
+
+    static std::uint8_t bits(delta d)
+    {
+        std::uint8_t res = 0;
+        for (; d != 0; d >>= 1) {
+            res++;
+        }
+        return res;
+    }
+
+    static std::size_t words(const std::size_t n, const std::size_t w)
+    {
+        return (n * w + 63) / 64;
+    }
+
+    static bool fits(const std::size_t n, const std::size_t w)
+    {
+        return align(words(n, w) * sizeof(word), alignof(Value)) + n * sizeof(Value) <= payload_size;
+    }
+
+    word load_word(const std::size_t i) const
+    {
+        word res;
+        std::memcpy(&res, payload + i * sizeof(word), sizeof(word));
+        return res;
+    }
+
+    void store_word(const std::size_t i, const word w)
+    {
+        std::memcpy(payload + i * sizeof(word), &w, sizeof(word));
+    }
+
+    word load_key(const std::size_t i) const
+    {
+        if (width == 0) {
+            return 0;
+        }
+        const std::size_t bit = i * width;
+        const std::size_t shift = bit % 64;
+        word res = load_word(bit / 64) >> shift;
+        if (shift + width > 64) {
+            res |= load_word(bit / 64 + 1) << (64 - shift);
+        }
+        return width == 64 ? res : res & ((word(1) << width) - 1);
+    }
+
+    void store_key(const std::size_t i, const word d)
+    {
+        if (width == 0) {
+            return;
+        }
+        const std::size_t bit = i * width;
+        const std::size_t shift = bit % 64;
+        store_word(bit / 64, load_word(bit / 64) | d << shift);
+        if (shift + width > 64) {
+            store_word(bit / 64 + 1, load_word(bit / 64 + 1) | d >> (64 - shift));
+        }
+    }
+
+    Key base{};
+    std::uint16_t count = 0;
+    std::uint16_t values_offset = 0;
+    std::uint8_t width = 0;
+    alignas(word) unsigned char payload[payload_size];
+};
+
+// Read-only tree over packed leaves, built from a sorted sequence of unique integer keys.
+// The first key of every leaf is kept in a flat index which is searched instead of inner nodes
+template <class Key, class Value>
+class PackedBPTree
+{
+    using leaf_type = Packed_leaf<Key, Value>;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<Key, Value>;
+    using size_type = std::size_t;
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<Key, Value>;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+
+        class pointer
+        {
+        public:
+            const value_type * operator->() const
+            {
+                return &item;
+            }
+
+            value_type item;
+        };
+
+        const_iterator() = default;
+
+        const_iterator(const PackedBPTree * tree, const std::size_t leaf, const std::size_t pos)
+            : tree(tree)
+            , leaf(leaf)
+            , pos(pos)
+        {
+            if (tree != nullptr && leaf < tree->leaves.size() && pos == tree->leaves[leaf].size()) {
+                this->leaf++;
+                this->pos = 0;
+            }
+        }
+
+        const_iterator & operator++()
+        {
+            if (++pos == tree->leaves[leaf].size()) {
+                leaf++;
+                pos = 0;
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            auto res = *this;
+            operator++();
+            return res;
+        }
+
+        reference operator*() const
+        {
+            const auto & block = tree->leaves[leaf];
+            return {block.key(pos), block.value(pos)};
+        }
+
+        pointer operator->() const
+        {
+            return pointer{**this};
+        }
+
+        friend bool operator==(const const_iterator & a, const const_iterator & b)
+        {
+            return a.leaf == b.leaf && a.pos == b.pos;
+        }
+
+        friend bool operator!=(const const_iterator & a, const const_iterator & b)
+        {
+            return !(a == b);
+        }
+
+    private:
+        const PackedBPTree * tree = nullptr;
+        std::size_t leaf = 0;
+        std::size_t pos = 0;
+    };
+
+    using iterator = const_iterator;
+
+    PackedBPTree() = default;
+
+    template <class Allocator>
+    explicit PackedBPTree(const BPTree<Key, Value, std::less<Key>, Allocator> & tree)
+        : PackedBPTree(tree.begin(), tree.end())
+    {
+    }
+
+    template <class It>
+    PackedBPTree(It begin, const It end)
+    {
+        std::vector<std::pair<Key, Value>> items;
+        if constexpr (std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<It>::iterator_category>) {
+            items.reserve(std::distance(begin, end));
+        }
+        for (; begin != end; ++begin) {
+            if (!items.empty() && !(items.back().first < begin->first)) {
+                throw std::invalid_argument("PackedBPTree: keys are not sorted and unique");
+            }
+            items.emplace_back(begin->first, begin->second);
+        }
+        for (auto i = items.cbegin(); i != items.cend();) {
+            leaves.emplace_back();
+            i = leaves.back().assign(i, items.cend());
+            firsts.push_back(leaves.back().key(0));
+        }
+        size_value = items.size();
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(this, 0, 0);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(this, leaves.size(), 0);
+    }
+
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+
+    const_iterator cend() const
+    {
+        return end();
+    }
+
+    bool empty() const
+    {
+        return size_value == 0;
+    }
+
+    size_type size() const
+    {
+        return size_value;
+    }
+
+    // Number of leaf blocks, each block_size bytes
+    std::size_t leaf_count() const
+    {
+        return leaves.size();
+    }
+
+    const_iterator lower_bound(const Key & key) const
+    {
+        const std::size_t leaf = leaf_of(key);
+        return const_iterator(this, leaf, leaf < leaves.size() ? leaves[leaf].position(key) : 0);
+    }
+
+    const_iterator upper_bound(const Key & key) const
+    {
+        auto res = lower_bound(key);
+        if (res != end() && res->first == key) {
+            ++res;
+        }
+        return res;
+    }
+
+    const_iterator find(const Key & key) const
+    {
+        const auto res = lower_bound(key);
+        return res != end() && res->first == key ? res : end();
+    }
+
+    bool contains(const Key & key) const
+    {
+        return find(key) != end();
+    }
+
+    size_type count(const Key & key) const
+    {
+        return contains(key) ? 1 : 0;
+    }
+
+    Value at(const Key & key) const
+    {
+        const auto res = find(key);
+        if (res == end()) {
+            throw std::out_of_range("Key not found");
+        }
+        return res->second;
+    }
+
+private:
+    // Leaf which holds key if it is present: the last one starting at or before key
+    std::size_t leaf_of(const Key & key) const
+    {
+        const auto res = std::upper_bound(firsts.begin(), firsts.end(), key);
+        return res == firsts.begin() ? 0 : res - firsts.begin() - 1;
+    }
+
+    std::vector<Key> firsts;
+    std::vector<leaf_type> leaves;
+    size_type size_value = 0;
+};
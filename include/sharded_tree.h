@@ -0,0 +1,426 @@
+#pragma once
+
+#include "bptree.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Range-partitioned set of independent trees for concurrent writers. Shard i holds the keys in
+// [bounds[i - 1], bounds[i]) and has its own lock, so writers to different ranges never meet.
+// Point operations are thread-safe; iteration and lower_bound must not run concurrently with
+// writers
+template <class Key, class Value, class Less = std::less<Key>>
+class ShardedBPTree
+{
+    using tree_type = BPTree<Key, Value, Less>;
+
+    struct shard
+    {
+        mutable std::shared_mutex lock;
+        tree_type tree;
+    };
+
+    template <bool constant>
+    class sharded_iterator
+    {
+        using owner = std::conditional_t<constant, const ShardedBPTree, ShardedBPTree>;
+        using base = std::conditional_t<constant, typename tree_type::const_iterator, typename tree_type::iterator>;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<Key, Value>;
+        using difference_type = std::ptrdiff_t;
+        using reference = typename base::reference;
+        using pointer = typename base::pointer;
+
+        sharded_iterator() = default;
+
+        sharded_iterator(owner * tree, const std::size_t index, const base it)
+            : tree(tree)
+            , index(index)
+            , it(it)
+        {
+            skip_empty();
+        }
+
+        sharded_iterator & operator++()
+        {
+            ++it;
+            skip_empty();
+            return *this;
+        }
+
+        sharded_iterator operator++(int)
+        {
+            auto res = *this;
+            operator++();
+            return res;
+        }
+
+        reference operator*() const
+        {
+            return *it;
+        }
+
+        pointer operator->() const
+        {
+            return it.operator->();
+        }
+
+        friend bool operator==(const sharded_iterator & a, const sharded_iterator & b)
+        {
+            return a.index == b.index && a.it == b.it;
+        }
+
+        friend bool operator!=(const sharded_iterator & a, const sharded_iterator & b)
+        {
+            return !(a == b);
+        }
+
+    private:
+        // Moves past the end of the current shard to the first element of the next non-empty one
+        void skip_empty()
+        {
+            while (index < tree->shards.size() && it == base()) {
+                if (++index < tree->shards.size()) {
+                    it = tree->shard_tree(index).begin();
+                }
+                else {
+                    it = base();
+                }
+            }
+        }
+
+        owner * tree = nullptr;
+        std::size_t index = 0;
+        base it;
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using size_type = std::size_t;
+    using iterator = sharded_iterator<false>;
+    using const_iterator = sharded_iterator<true>;
+
+    ShardedBPTree()
+        : ShardedBPTree(std::vector<Key>())
+    {
+    }
+
+    // One shard more than there are split points, the points have to be sorted and unique
+    explicit ShardedBPTree(std::vector<Key> split_points)
+        : bounds(std::move(split_points))
+    {
+        for (std::size_t i = 0; i <= bounds.size(); ++i) {
+            shards.push_back(std::make_unique<shard>());
+        }
+    }
+
+    // Split points which cut a sample of the expected keys into equally populated ranges
+    static std::vector<Key> split_points(std::vector<Key> sample, const std::size_t shard_count)
+    {
+        std::sort(sample.begin(), sample.end());
+        std::vector<Key> res;
+        for (std::size_t i = 1; i < shard_count && !sample.empty(); ++i) {
+            const Key & key = sample[i * sample.size() / shard_count];
+            if (res.empty() || res.back() < key) {
+                res.push_back(key);
+            }
+        }
+        return res;
+    }
+
+    std::size_t shard_count() const
+    {
+        return shards.size();
+    }
+
+    bool insert(const Key & key, const Value & value)
+    {
+        return write(key, [&](tree_type & tree) {
+            return tree.insert(key, value).second;
+        });
+    }
+
+    bool insert(const Key & key, Value && value)
+    {
+        return write(key, [&](tree_type & tree) {
+            return tree.insert(key, std::move(value)).second;
+        });
+    }
+
+    size_type erase(const Key & key)
+    {
+        return write(key, [&](tree_type & tree) {
+            return tree.erase(key);
+        });
+    }
+
+    // Locks every shard the batch touches before changing any of them, so a reader sees either
+    // none or all of its updates
+    void apply(WriteBatch<Key, Value> batch)
+    {
+        auto items = batch.take_sorted();
+        std::shared_lock router_lock(router);
+        // touched shards in increasing order with the first message of each
+        std::vector<std::pair<std::size_t, decltype(items.begin())>> parts;
+        for (auto i = items.begin(); i != items.end();) {
+            const std::size_t index = shard_of(i->key);
+            parts.emplace_back(index, i);
+            i = index == bounds.size()
+                    ? items.end()
+                    : std::lower_bound(i, items.end(), bounds[index], [](const auto & lhs, const auto & rhs) {
+                          return lhs.key < rhs;
+                      });
+        }
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        for (const auto & part : parts) {
+            locks.emplace_back(shards[part.first]->lock);
+        }
+        for (std::size_t j = 0; j < parts.size(); ++j) {
+            const auto last = j + 1 < parts.size() ? parts[j + 1].second : items.end();
+            shard_tree(parts[j].first).apply_sorted(parts[j].second, last);
+        }
+    }
+
+    bool contains(const Key & key) const
+    {
+        return read(key, [&](const tree_type & tree) {
+            return tree.contains(key);
+        });
+    }
+
+    size_type count(const Key & key) const
+    {
+        return contains(key) ? 1 : 0;
+    }
+
+    // Copy of the value, the shard may change as soon as its lock is released
+    std::optional<Value> get(const Key & key) const
+    {
+        return read(key, [&](const tree_type & tree) {
+            const auto it = tree.find(key);
+            return it != tree.end() ? std::optional<Value>(it->second) : std::nullopt;
+        });
+    }
+
+    size_type size() const
+    {
+        std::shared_lock router_lock(router);
+        size_type res = 0;
+        for (const auto & item : shards) {
+            std::shared_lock lock(item->lock);
+            res += item->tree.size();
+        }
+        return res;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    void clear()
+    {
+        std::unique_lock router_lock(router);
+        for (auto & item : shards) {
+            std::unique_lock lock(item->lock);
+            item->tree.clear();
+        }
+    }
+
+    iterator begin()
+    {
+        return iterator(this, 0, shard_tree(0).begin());
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(this, 0, shard_tree(0).begin());
+    }
+
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+
+    iterator end()
+    {
+        return iterator(this, shards.size(), typename tree_type::iterator());
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(this, shards.size(), typename tree_type::const_iterator());
+    }
+
+    const_iterator cend() const
+    {
+        return end();
+    }
+
+    iterator find(const Key & key)
+    {
+        const std::size_t i = shard_of(key);
+        const auto it = shard_tree(i).find(key);
+        return it != shard_tree(i).end() ? iterator(this, i, it) : end();
+    }
+
+    const_iterator find(const Key & key) const
+    {
+        const std::size_t i = shard_of(key);
+        const auto it = shard_tree(i).find(key);
+        return it != shard_tree(i).end() ? const_iterator(this, i, it) : end();
+    }
+
+    // An end of shard is continued by the first element of the next non-empty shard
+    iterator lower_bound(const Key & key)
+    {
+        const std::size_t i = shard_of(key);
+        return iterator(this, i, shard_tree(i).lower_bound(key));
+    }
+
+    const_iterator lower_bound(const Key & key) const
+    {
+        const std::size_t i = shard_of(key);
+        return const_iterator(this, i, shard_tree(i).lower_bound(key));
+    }
+
+    iterator upper_bound(const Key & key)
+    {
+        const std::size_t i = shard_of(key);
+        return iterator(this, i, shard_tree(i).upper_bound(key));
+    }
+
+    const_iterator upper_bound(const Key & key) const
+    {
+        const std::size_t i = shard_of(key);
+        return const_iterator(this, i, shard_tree(i).upper_bound(key));
+    }
+
+    // Evens out neighbouring shards whose sizes differ by more than the given factor by moving the
+    // boundary range from the bigger one to the smaller one. The new bound is estimated by a single
+    // descent from the root of the bigger shard under shared locks, the range is then cut and
+    // grafted with split_at and join, so the router is held exclusively only for work logarithmic
+    // in the shard size and no element is copied or walked
+    void rebalance(const double tolerance = 2.0)
+    {
+        std::lock_guard guard(rebalancing);
+        for (std::size_t i = 0; i + 1 < shards.size(); ++i) {
+            std::optional<Key> bound;
+            bool from_left = false;
+            {
+                std::shared_lock router_lock(router);
+                std::shared_lock left_lock(shards[i]->lock);
+                std::shared_lock right_lock(shards[i + 1]->lock);
+                const auto & left = shards[i]->tree;
+                const auto & right = shards[i + 1]->tree;
+                const std::size_t left_size = left.size();
+                const std::size_t right_size = right.size();
+                const std::size_t moved = (std::max(left_size, right_size) - std::min(left_size, right_size)) / 2;
+                if (moved == 0 || std::max(left_size, right_size) <= tolerance * std::min(left_size, right_size)) {
+                    continue;
+                }
+                from_left = left_size > right_size;
+                bound = from_left ? key_at(left, static_cast<double>(left_size - moved) / left_size)
+                                  : key_at(right, static_cast<double>(moved) / right_size);
+            }
+            if (!bound) {
+                continue;
+            }
+            // only rebalance changes the bounds, so the estimated key still lies in the range of
+            // the bigger shard even if it has been erased since
+            std::unique_lock router_lock(router);
+            std::unique_lock left_lock(shards[i]->lock);
+            std::unique_lock right_lock(shards[i + 1]->lock);
+            auto & left = shards[i]->tree;
+            auto & right = shards[i + 1]->tree;
+            if (from_left) {
+                auto range = left.split_at(*bound);
+                right.join(range);
+            }
+            else {
+                auto rest = right.split_at(*bound);
+                left.join(right);
+                right.join(rest);
+            }
+            bounds[i] = *bound;
+            router_lock.unlock();
+            // recount while the shards are still locked, size() must not write under the shared
+            // locks of readers
+            left.size();
+            right.size();
+        }
+    }
+
+private:
+    tree_type & shard_tree(const std::size_t i)
+    {
+        return shards[i]->tree;
+    }
+
+    const tree_type & shard_tree(const std::size_t i) const
+    {
+        return shards[i]->tree;
+    }
+
+    std::size_t shard_of(const Key & key) const
+    {
+        return std::upper_bound(bounds.begin(), bounds.end(), key) - bounds.begin();
+    }
+
+    // Key at about the given share of the elements of a tree, found by one descent from the root
+    // which assumes the nodes below are evenly filled, nothing for an empty tree
+    static std::optional<Key> key_at(const tree_type & tree, double share)
+    {
+        using inner_type = Inner_node<Key, Value, Less>;
+        const Node<Key, Value, Less> * node = tree.root;
+        std::optional<Key> res;
+        while (const auto * inner = dynamic_cast<const inner_type *>(node)) {
+            const double scaled = share * inner->size;
+            const std::size_t i = std::min(static_cast<std::size_t>(scaled), inner->size - 1);
+            share = scaled - i;
+            res = inner->data[i].first;
+            node = inner->data[i].second;
+        }
+        const auto * leaf = static_cast<const Leaf<Key, Value, Less> *>(node);
+        if (leaf->size > 0) {
+            res = leaf->data[std::min(static_cast<std::size_t>(share * leaf->size), leaf->size - 1)].first;
+        }
+        return res;
+    }
+
+    template <class F>
+    auto write(const Key & key, F && f)
+    {
+        std::shared_lock router_lock(router);
+        auto & item = *shards[shard_of(key)];
+        std::unique_lock lock(item.lock);
+        return f(item.tree);
+    }
+
+    template <class F>
+    auto read(const Key & key, F && f) const
+    {
+        std::shared_lock router_lock(router);
+        const auto & item = *shards[shard_of(key)];
+        std::shared_lock lock(item.lock);
+        return f(item.tree);
+    }
+
+    std::vector<Key> bounds;
+    std::vector<std::unique_ptr<shard>> shards;
+    mutable std::shared_mutex router;
+    // one rebalance at a time, the bounds change nowhere else
+    std::mutex rebalancing;
+};
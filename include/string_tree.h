@@ -0,0 +1,530 @@
+#pragma once
+
+#include "bptree.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Handle of a string key: the first bytes are kept inline and decide most comparisons, longer
+// keys point to their bytes in the string arena of the tree. Keys that fit the prefix own no
+// other memory
+class string_key
+{
+public:
+    static constexpr std::size_t prefix_size = 8;
+
+    string_key() = default;
+
+    // Handle of a key stored elsewhere, e.g. to look it up
+    explicit string_key(const std::string_view key)
+        : length(static_cast<std::uint32_t>(key.size()))
+        , bytes(key.size() > prefix_size ? key.data() : nullptr)
+    {
+        std::memcpy(prefix, key.data(), std::min(key.size(), prefix_size));
+    }
+
+    std::string_view view() const
+    {
+        return {bytes != nullptr ? bytes : prefix, length};
+    }
+
+    operator std::string_view() const
+    {
+        return view();
+    }
+
+    std::size_t size() const
+    {
+        return length;
+    }
+
+    // Whether the bytes of the key are outside the handle
+    bool external() const
+    {
+        return bytes != nullptr;
+    }
+
+    friend bool operator<(const string_key & a, const string_key & b)
+    {
+        const std::uint64_t x = a.order();
+        const std::uint64_t y = b.order();
+        if (x != y) {
+            return x < y;
+        }
+        return a.compare_rest(b) < 0;
+    }
+
+    friend bool operator>(const string_key & a, const string_key & b)
+    {
+        return b < a;
+    }
+
+    friend bool operator==(const string_key & a, const string_key & b)
+    {
+        return a.length == b.length && std::memcmp(a.prefix, b.prefix, prefix_size) == 0 && a.compare_rest(b) == 0;
+    }
+
+    friend bool operator!=(const string_key & a, const string_key & b)
+    {
+        return !(a == b);
+    }
+
+    friend std::ostream & operator<<(std::ostream & out, const string_key & k)
+    {
+        return out << k.view();
+    }
+
+private:
+    friend class String_arena;
+
+    // The prefix as a number ordered like the bytes
+    std::uint64_t order() const
+    {
+        std::uint64_t res;
+        std::memcpy(&res, prefix, sizeof(res));
+        if constexpr (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) {
+            res = __builtin_bswap64(res);
+        }
+        return res;
+    }
+
+    // Compares the bytes after equal prefixes, then the lengths
+    int compare_rest(const string_key & k) const
+    {
+        const std::size_t n = std::min(length, k.length);
+        if (n > prefix_size) {
+            const int res = std::memcmp(bytes + prefix_size, k.bytes + prefix_size, n - prefix_size);
+            if (res != 0) {
+                return res;
+            }
+        }
+        return length < k.length ? -1 : (length > k.length ? 1 : 0);
+    }
+
+    char prefix[prefix_size] = {};
+    std::uint32_t length = 0;
+    const char * bytes = nullptr;
+};
+
+static_assert(std::is_trivially_copyable_v<string_key>);
+
+// Append-only storage for the bytes of the external keys of a tree. Bytes of erased keys stay
+// until the tree compacts the arena, which copies the keys still referenced into a new one
+class String_arena
+{
+public:
+    static constexpr std::size_t chunk_size = std::size_t(64) << 10;
+
+    string_key store(const std::string_view key)
+    {
+        if (key.size() > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("String_arena: key is too long");
+        }
+        string_key res(key);
+        if (!res.external()) {
+            return res;
+        }
+        if (key.size() > chunk_size / 4) {
+            // long keys get a block of their own, so the open chunk keeps its room
+            large.push_back(std::make_unique<char[]>(key.size()));
+            std::memcpy(large.back().get(), key.data(), key.size());
+            live += key.size();
+            reserved += key.size();
+            res.bytes = large.back().get();
+            return res;
+        }
+        if (key.size() > chunk_size - used) {
+            chunks.push_back(std::make_unique<char[]>(chunk_size));
+            used = 0;
+            reserved += chunk_size;
+        }
+        char * out = chunks.back().get() + used;
+        std::memcpy(out, key.data(), key.size());
+        used += key.size();
+        live += key.size();
+        res.bytes = out;
+        return res;
+    }
+
+    // Undoes store for a key that did not make it into the tree
+    void discard(const string_key & key)
+    {
+        if (!key.external()) {
+            return;
+        }
+        live -= key.size();
+        if (!large.empty() && key.bytes == large.back().get()) {
+            large.pop_back();
+            reserved -= key.size();
+        }
+        else if (key.bytes + key.size() == chunks.back().get() + used) {
+            used -= key.size();
+        }
+        else {
+            dead += key.size();
+        }
+    }
+
+    // The key left the tree, its bytes may still be referenced by separators until the next
+    // compaction
+    void release(const string_key & key)
+    {
+        if (key.external()) {
+            live -= key.size();
+            dead += key.size();
+        }
+    }
+
+    // Bytes of keys still in the tree
+    std::size_t live_bytes() const
+    {
+        return live;
+    }
+
+    // Bytes of released keys which only a compaction gives back
+    std::size_t dead_bytes() const
+    {
+        return dead;
+    }
+
+    std::size_t reserved_bytes() const
+    {
+        return reserved;
+    }
+
+    void swap(String_arena & arena) noexcept
+    {
+        chunks.swap(arena.chunks);
+        large.swap(arena.large);
+        std::swap(used, arena.used);
+        std::swap(live, arena.live);
+        std::swap(dead, arena.dead);
+        std::swap(reserved, arena.reserved);
+    }
+
+private:
+    std::vector<std::unique_ptr<char[]>> chunks;
+    std::vector<std::unique_ptr<char[]>> large;
+    // bytes taken in the last chunk
+    std::size_t used = chunk_size;
+    std::size_t live = 0;
+    std::size_t dead = 0;
+    std::size_t reserved = 0;
+};
+
+template <class Value, class Base, bool constant>
+class string_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::pair<const std::string_view, Value>;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::pair<std::string_view, std::conditional_t<constant, const Value &, Value &>>;
+
+    class pointer
+    {
+    public:
+        const reference * operator->() const
+        {
+            return &ref;
+        }
+
+        reference ref;
+    };
+
+    string_iterator() = default;
+
+    explicit string_iterator(Base it)
+        : it(it)
+    {
+    }
+
+    string_iterator & operator++()
+    {
+        ++it;
+        return *this;
+    }
+
+    string_iterator operator++(int)
+    {
+        auto res = *this;
+        operator++();
+        return res;
+    }
+
+    reference operator*() const
+    {
+        auto && item = *it;
+        return reference(item.first.view(), item.second);
+    }
+
+    pointer operator->() const
+    {
+        return pointer{**this};
+    }
+
+    const Base & base() const
+    {
+        return it;
+    }
+
+    friend bool operator==(const string_iterator & a, const string_iterator & b)
+    {
+        return a.it == b.it;
+    }
+
+    friend bool operator!=(const string_iterator & a, const string_iterator & b)
+    {
+        return a.it != b.it;
+    }
+
+private:
+    Base it;
+};
+
+// B+ tree with string keys stored in a tree-owned arena. Nodes hold fixed-size string_key handles,
+// so a key is copied once on insert and separators are copied as handles without allocating.
+// Once the bytes of erased keys outweigh the live ones, the keys still referenced are copied into
+// a fresh arena. Views of keys handed out before a compaction dangle after it
+template <class Value>
+class StringBPTree
+{
+    using tree_type = BPTree<string_key, Value>;
+
+public:
+    using key_type = std::string_view;
+    using mapped_type = Value;
+    using value_type = std::pair<const std::string_view, Value>;
+    using size_type = std::size_t;
+
+    using iterator = string_iterator<Value, typename tree_type::iterator, false>;
+    using const_iterator = string_iterator<Value, typename tree_type::const_iterator, true>;
+
+    StringBPTree() = default;
+
+    StringBPTree(std::initializer_list<std::pair<std::string_view, Value>> list)
+    {
+        for (const auto & [key, value] : list) {
+            insert(key, value);
+        }
+    }
+
+    StringBPTree(const StringBPTree & tree)
+    {
+        for (const auto & [key, value] : tree) {
+            insert(key, value);
+        }
+    }
+
+    StringBPTree(StringBPTree &&) = default;
+
+    StringBPTree & operator=(StringBPTree tree)
+    {
+        swap(tree);
+        return *this;
+    }
+
+    void swap(StringBPTree & tree) noexcept
+    {
+        this->tree.swap(tree.tree);
+        keys.swap(tree.keys);
+    }
+
+    iterator begin()
+    {
+        return iterator(tree.begin());
+    }
+
+    const_iterator cbegin() const
+    {
+        return const_iterator(tree.cbegin());
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(tree.begin());
+    }
+
+    iterator end()
+    {
+        return iterator(tree.end());
+    }
+
+    const_iterator cend() const
+    {
+        return const_iterator(tree.cend());
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(tree.end());
+    }
+
+    bool empty() const
+    {
+        return tree.empty();
+    }
+
+    size_type size() const
+    {
+        return tree.size();
+    }
+
+    void clear()
+    {
+        tree.clear();
+        keys = String_arena();
+    }
+
+    size_type count(const std::string_view key) const
+    {
+        return tree.count(string_key(key));
+    }
+
+    bool contains(const std::string_view key) const
+    {
+        return tree.contains(string_key(key));
+    }
+
+    iterator find(const std::string_view key)
+    {
+        return iterator(tree.find(string_key(key)));
+    }
+
+    const_iterator find(const std::string_view key) const
+    {
+        return const_iterator(tree.find(string_key(key)));
+    }
+
+    iterator lower_bound(const std::string_view key)
+    {
+        return iterator(tree.lower_bound(string_key(key)));
+    }
+
+    const_iterator lower_bound(const std::string_view key) const
+    {
+        return const_iterator(tree.lower_bound(string_key(key)));
+    }
+
+    iterator upper_bound(const std::string_view key)
+    {
+        return iterator(tree.upper_bound(string_key(key)));
+    }
+
+    const_iterator upper_bound(const std::string_view key) const
+    {
+        return const_iterator(tree.upper_bound(string_key(key)));
+    }
+
+    // 'at' method throws std::out_of_range if there is no such key
+    Value & at(const std::string_view key)
+    {
+        return tree.at(string_key(key));
+    }
+
+    const Value & at(const std::string_view key) const
+    {
+        return tree.at(string_key(key));
+    }
+
+    std::pair<iterator, bool> insert(const std::string_view key, const Value & value)
+    {
+        const string_key stored = keys.store(key);
+        const auto res = tree.insert(stored, value);
+        if (!res.second) {
+            keys.discard(stored);
+        }
+        return {iterator(res.first), res.second};
+    }
+
+    std::pair<iterator, bool> insert(const std::string_view key, Value && value)
+    {
+        const string_key stored = keys.store(key);
+        const auto res = tree.insert(stored, std::move(value));
+        if (!res.second) {
+            keys.discard(stored);
+        }
+        return {iterator(res.first), res.second};
+    }
+
+    iterator erase(iterator it)
+    {
+        if (it == end()) {
+            return it;
+        }
+        keys.release(it.base()->first);
+        auto res = iterator(tree.erase(it.base()));
+        if (keys.dead_bytes() >= String_arena::chunk_size && keys.dead_bytes() > keys.live_bytes()) {
+            // the next element is found again, the compaction rewrites the key it points to
+            const std::optional<std::string> next = res != end() ? std::optional<std::string>(res->first) : std::nullopt;
+            compact();
+            return next ? lower_bound(*next) : end();
+        }
+        return res;
+    }
+
+    size_type erase(const std::string_view key)
+    {
+        const auto it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    // Copies the keys still referenced by the tree, separators included, into a new arena and
+    // drops the old one
+    void compact()
+    {
+        String_arena res;
+        std::unordered_map<const char *, string_key> moved;
+        const auto move = [&](string_key & key) {
+            if (key.external()) {
+                const auto [it, fresh] = moved.try_emplace(key.view().data());
+                if (fresh) {
+                    it->second = res.store(key.view());
+                }
+                key = it->second;
+            }
+        };
+        tree_type::for_each_node(tree.root, [&](Node<string_key, Value> * node) {
+            if (auto * leaf = dynamic_cast<Leaf<string_key, Value, std::less<string_key>> *>(node)) {
+                for (std::size_t i = 0; i < leaf->size; ++i) {
+                    move(leaf->data[i].first);
+                }
+            }
+            else {
+                auto * inner = static_cast<Inner_node<string_key, Value> *>(node);
+                for (std::size_t i = 0; i < inner->size; ++i) {
+                    move(inner->data[i].first);
+                }
+            }
+        });
+        keys.swap(res);
+    }
+
+    const String_arena & arena() const
+    {
+        return keys;
+    }
+
+private:
+    tree_type tree;
+    String_arena keys;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "node.h"
+#include "value_arena.h"
 
 #include <functional>
 #include <type_traits>
@@ -21,6 +22,10 @@ class tree_iterator : public std::iterator<std::forward_iterator_tag, std::pair<
 public:
     using type = typename std::conditional_t<constant, const std::pair<Key, Value>, std::pair<Key, Value>>;
     using type_curr = typename std::conditional_t<constant, const Leaf<Key, Value, Less> *, Leaf<Key, Value, Less> *>;
+    using slot = leaf_slot<Key, Value>;
+    // a pair of references instead of a pair reference when values are kept out of line
+    using reference = std::conditional_t<constant, typename slot::const_reference, typename slot::reference>;
+    using pointer = std::conditional_t<constant, typename slot::const_pointer, typename slot::pointer>;
 
     tree_iterator()
         : curr(nullptr)
@@ -59,7 +64,7 @@ public:
         return res;
     }
 
-    type & operator*() const
+    reference operator*() const
     {
         return (*curr)[pos];
     }
@@ -69,14 +74,14 @@ public:
         return pos;
     }
 
-    type & operator*()
+    type_curr node() const
     {
-        return (*curr)[pos];
+        return curr;
     }
 
-    type * operator->()
+    pointer operator->() const
     {
-        return &(*curr)[pos];
+        return slot::address(curr->data[pos]);
     }
 
     friend bool operator==(const tree_iterator a, const tree_iterator b)
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Values bigger than this are kept out of line: a leaf slot then holds the key and a pointer to the
+// value in the tree's value arena, so leaf fanout does not depend on the size of the value
+inline constexpr std::size_t max_inline_value_size = 64;
+
+// What operator-> of an iterator returns when elements are handed out by value as a pair of references
+template <class Reference>
+class arrow_proxy
+{
+public:
+    const Reference * operator->() const
+    {
+        return &ref;
+    }
+
+    Reference ref;
+};
+
+template <class Key, class Value>
+struct leaf_slot
+{
+    using record = std::pair<Key, Value>;
+    static constexpr bool out_of_line = sizeof(Value) > max_inline_value_size;
+    using type = std::conditional_t<out_of_line, std::pair<Key, Value *>, record>;
+    // an out of line element is seen through the key in the slot and the value in the arena
+    using reference = std::conditional_t<out_of_line, std::pair<const Key &, Value &>, record &>;
+    using const_reference = std::conditional_t<out_of_line, std::pair<const Key &, const Value &>, const record &>;
+    using pointer = std::conditional_t<out_of_line, arrow_proxy<reference>, record *>;
+    using const_pointer = std::conditional_t<out_of_line, arrow_proxy<const_reference>, const record *>;
+
+    static reference get(type & slot)
+    {
+        if constexpr (out_of_line) {
+            return reference(slot.first, *slot.second);
+        }
+        else {
+            return slot;
+        }
+    }
+
+    static const_reference get(const type & slot)
+    {
+        if constexpr (out_of_line) {
+            return const_reference(slot.first, *slot.second);
+        }
+        else {
+            return slot;
+        }
+    }
+
+    static pointer address(type & slot)
+    {
+        if constexpr (out_of_line) {
+            return pointer{get(slot)};
+        }
+        else {
+            return &slot;
+        }
+    }
+
+    static const_pointer address(const type & slot)
+    {
+        if constexpr (out_of_line) {
+            return const_pointer{get(slot)};
+        }
+        else {
+            return &slot;
+        }
+    }
+};
+
+template <class Key, class Value, bool out_of_line = leaf_slot<Key, Value>::out_of_line>
+class Value_arena
+{
+    using slot_type = typename leaf_slot<Key, Value>::type;
+
+public:
+    template <class K, class V>
+    slot_type make_slot(K && key, V && value)
+    {
+        return slot_type(std::forward<K>(key), std::forward<V>(value));
+    }
+
+    void discard(const slot_type &) {}
+
+    void destroy(const slot_type &) {}
+
+    template <class It>
+    void clear(It, It)
+    {
+    }
+
+    void swap(Value_arena &) noexcept {}
+
+    void use(std::pmr::memory_resource *) {}
+
+    void share(const Value_arena &) {}
+
+    void adopt(Value_arena &) {}
+};
+
+template <class Key, class Value>
+class Value_arena<Key, Value, true>
+{
+    using slot_type = typename leaf_slot<Key, Value>::type;
+
+    // only the value lives here, the key stays in the leaf slot
+    union cell
+    {
+        cell * next;
+        alignas(Value) unsigned char storage[sizeof(Value)];
+    };
+
+    static constexpr std::size_t chunk_size = 64;
+
+public:
+    Value_arena() = default;
+
+    Value_arena(const Value_arena &) = delete;
+
+    Value_arena(Value_arena && arena) noexcept
+    {
+        swap(arena);
+    }
+
+    Value_arena & operator=(const Value_arena &) = delete;
+
+    Value_arena & operator=(Value_arena && arena) noexcept
+    {
+        Value_arena res(std::move(arena));
+        swap(res);
+        return *this;
+    }
+
+    void swap(Value_arena & arena) noexcept
+    {
+        std::swap(chunks, arena.chunks);
+        std::swap(bump, arena.bump);
+        std::swap(used, arena.used);
+        std::swap(free_cells, arena.free_cells);
+        std::swap(free_tail, arena.free_tail);
+        std::swap(resource, arena.resource);
+    }
+
+    // Chunks allocated from now on come from the resource, nullptr for the global heap
+    void use(std::pmr::memory_resource * value)
+    {
+        resource = value;
+    }
+
+    template <class K, class V>
+    slot_type make_slot(K && key, V && value)
+    {
+        cell * c = allocate();
+        try {
+            auto * res = new (c->storage) Value(std::forward<V>(value));
+            return slot_type(std::forward<K>(key), res);
+        }
+        catch (...) {
+            release(c);
+            throw;
+        }
+    }
+
+    // Undoes make_slot for a slot that did not make it into the tree
+    void discard(const slot_type & slot)
+    {
+        destroy(slot);
+    }
+
+    // Destroys the value of an element leaving the tree
+    void destroy(const slot_type & slot)
+    {
+        slot.second->~Value();
+        release(reinterpret_cast<cell *>(slot.second));
+    }
+
+    // Destroys the values of all live elements and gives the chunks back
+    template <class It>
+    void clear(It begin, It end)
+    {
+        for (auto i = begin; i != end; ++i) {
+            std::destroy_at(&(*i).second);
+        }
+        auto * kept = resource;
+        *this = Value_arena();
+        resource = kept;
+    }
+
+    // Keeps the chunks of another arena alive: used when values move to another tree
+    // without being copied, e.g. when a tree is split
+    void share(const Value_arena & arena)
+    {
+        chunks.insert(chunks.end(), arena.chunks.begin(), arena.chunks.end());
+        std::sort(chunks.begin(), chunks.end());
+        chunks.erase(std::unique(chunks.begin(), chunks.end()), chunks.end());
+    }
+
+    // Takes over the chunks and the free cells of another arena
+    void adopt(Value_arena & arena)
+    {
+        share(arena);
+        if (arena.free_cells != nullptr) {
+            arena.free_tail->next = free_cells;
+            if (free_cells == nullptr) {
+                free_tail = arena.free_tail;
+            }
+            free_cells = arena.free_cells;
+        }
+        auto * kept = arena.resource;
+        arena = Value_arena();
+        arena.resource = kept;
+    }
+
+private:
+    cell * allocate()
+    {
+        if (free_cells != nullptr) {
+            cell * res = free_cells;
+            free_cells = res->next;
+            if (free_cells == nullptr) {
+                free_tail = nullptr;
+            }
+            return res;
+        }
+        if (used == chunk_size) {
+            if (resource != nullptr) {
+                auto * chunk = static_cast<cell *>(resource->allocate(sizeof(cell) * chunk_size, alignof(cell)));
+                chunks.emplace_back(chunk, [r = resource](cell * c) {
+                    r->deallocate(c, sizeof(cell) * chunk_size, alignof(cell));
+                });
+            }
+            else {
+                chunks.emplace_back(new cell[chunk_size]);
+            }
+            bump = chunks.back().get();
+            used = 0;
+        }
+        return &bump[used++];
+    }
+
+    void release(cell * c)
+    {
+        c->next = free_cells;
+        if (free_cells == nullptr) {
+            free_tail = c;
+        }
+        free_cells = c;
+    }
+
+    std::vector<std::shared_ptr<cell[]>> chunks;
+    cell * bump = nullptr;
+    std::size_t used = chunk_size;
+    cell * free_cells = nullptr;
+    cell * free_tail = nullptr;
+    std::pmr::memory_resource * resource = nullptr;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "message_buffer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Group of puts and erases which a tree applies as a whole. Operations on the same key are
+// folded in the order they were added, so the last one wins
+template <class Key, class Value>
+class WriteBatch
+{
+    using buffer_type = Message_buffer<Key, Value>;
+    using kind = typename buffer_type::Kind;
+
+public:
+    using message = typename buffer_type::message;
+
+    void put(const Key & key, const Value & value)
+    {
+        items.push_back(message{key, kind::assign, value});
+    }
+
+    void put(Key && key, Value && value)
+    {
+        items.push_back(message{std::move(key), kind::assign, std::move(value)});
+    }
+
+    void erase(const Key & key)
+    {
+        items.push_back(message{key, kind::erase, std::nullopt});
+    }
+
+    bool empty() const
+    {
+        return items.empty();
+    }
+
+    // Number of operations added, before the ones on the same key are folded
+    std::size_t size() const
+    {
+        return items.size();
+    }
+
+    void clear()
+    {
+        items.clear();
+    }
+
+    // Sorts the operations by key and folds them into one per key, leaves the batch empty
+    std::vector<message> take_sorted()
+    {
+        std::stable_sort(items.begin(), items.end(), [](const auto & lhs, const auto & rhs) {
+            return lhs.key < rhs.key;
+        });
+        if (items.empty()) {
+            return {};
+        }
+        auto last = items.begin();
+        for (auto i = std::next(items.begin()); i != items.end(); ++i) {
+            if (i->key == last->key) {
+                buffer_type::combine(*last, std::move(*i));
+            }
+            else if (++last != i) {
+                *last = std::move(*i);
+            }
+        }
+        items.erase(std::next(last), items.end());
+        return std::exchange(items, std::vector<message>());
+    }
+
+private:
+    std::vector<message> items;
+};
@@ -1,16 +1,419 @@
 #include "bptree.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
-int main()
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+using record = std::pair<std::string_view, std::string_view>;
+// Keys and values point into the mapped input or snapshot, which outlives the tree
+using tree_type = BPTree<std::string_view, std::string_view>;
+
+constexpr char snapshot_magic[8] = {'B', 'P', 'T', 'S', 'N', 'A', 'P', '1'};
+constexpr std::size_t query_batch = 1024;
+constexpr std::size_t output_chunk = std::size_t(1) << 20;
+
+// Read-only view of a whole file, mapped where the system allows it
+class Mapped_file
+{
+public:
+    explicit Mapped_file(const std::string & path)
+    {
+#if defined(__unix__)
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        length = static_cast<std::size_t>(info.st_size);
+        if (length > 0) {
+            void * p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+            ::madvise(p, length, MADV_SEQUENTIAL);
+            mapping = static_cast<const char *>(p);
+        }
+        ::close(fd);
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        mapping = copy.data();
+        length = copy.size();
+#endif
+    }
+
+    Mapped_file(const Mapped_file &) = delete;
+
+    Mapped_file & operator=(const Mapped_file &) = delete;
+
+    ~Mapped_file()
+    {
+#if defined(__unix__)
+        if (mapping != nullptr) {
+            ::munmap(const_cast<char *>(mapping), length);
+        }
+#endif
+    }
+
+    std::string_view view() const
+    {
+        return {mapping, length};
+    }
+
+private:
+    const char * mapping = nullptr;
+    std::size_t length = 0;
+#if !defined(__unix__)
+    std::string copy;
+#endif
+};
+
+// Collects output and writes it in large chunks
+class Output
+{
+public:
+    ~Output()
+    {
+        flush();
+    }
+
+    Output & operator<<(const std::string_view text)
+    {
+        buffer.append(text);
+        if (buffer.size() >= output_chunk) {
+            flush();
+        }
+        return *this;
+    }
+
+    void flush()
+    {
+        std::fwrite(buffer.data(), 1, buffer.size(), stdout);
+        buffer.clear();
+    }
+
+private:
+    std::string buffer;
+};
+
+class Stopwatch
+{
+public:
+    // Reports the time since the last report to stderr, with the throughput of items and bytes
+    void report(const char * phase, const std::size_t items, const std::size_t bytes = 0)
+    {
+        const auto now = clock_type::now();
+        const double seconds = std::chrono::duration<double>(now - start).count();
+        start = now;
+        std::fprintf(stderr, "%-8s %10.1f ms %12zu items %10.2f M items/s", phase, seconds * 1e3, items, items / seconds / 1e6);
+        if (bytes > 0) {
+            std::fprintf(stderr, " %10.1f MB/s", bytes / seconds / 1e6);
+        }
+        std::fprintf(stderr, "\n");
+    }
+
+private:
+    clock_type::time_point start = clock_type::now();
+};
+
+// Splits the text into lines without copying them, a line "key<TAB>value" holds its value
+std::vector<record> split_lines(const std::string_view text)
+{
+    std::vector<record> res;
+    res.reserve(std::count(text.begin(), text.end(), '\n') + 1);
+    std::size_t begin = 0;
+    while (begin < text.size()) {
+        std::size_t end = text.find('\n', begin);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+        const std::string_view line = text.substr(begin, end - begin);
+        const std::size_t tab = line.find('\t');
+        if (tab == std::string_view::npos) {
+            res.emplace_back(line, line);
+        }
+        else {
+            res.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+        }
+        begin = end + 1;
+    }
+    return res;
+}
+
+// Stable sort by key: runs are sorted on separate threads, then merged pairwise in parallel
+void parallel_sort(std::vector<record> & items, std::size_t threads)
+{
+    const auto less = [](const record & lhs, const record & rhs) {
+        return lhs.first < rhs.first;
+    };
+    threads = std::max<std::size_t>(1, std::min(threads, items.size() / 4096 + 1));
+    std::vector<std::size_t> bounds;
+    for (std::size_t i = 0; i <= threads; ++i) {
+        bounds.push_back(items.size() * i / threads);
+    }
+    const auto run = [&](const std::size_t count, auto && task) {
+        std::vector<std::thread> workers;
+        for (std::size_t i = 1; i < count; ++i) {
+            workers.emplace_back(task, i);
+        }
+        task(0);
+        for (auto & worker : workers) {
+            worker.join();
+        }
+    };
+    run(threads, [&](const std::size_t i) {
+        std::stable_sort(items.begin() + bounds[i], items.begin() + bounds[i + 1], less);
+    });
+    while (bounds.size() > 2) {
+        std::vector<std::size_t> merged;
+        for (std::size_t i = 0; i < bounds.size(); i += 2) {
+            merged.push_back(bounds[i]);
+        }
+        if (merged.back() != bounds.back()) {
+            merged.push_back(bounds.back());
+        }
+        run((bounds.size() - 1) / 2, [&](const std::size_t i) {
+            const auto first = items.begin() + bounds[2 * i];
+            std::inplace_merge(first, items.begin() + bounds[2 * i + 1], items.begin() + bounds[2 * i + 2], less);
+        });
+        bounds = std::move(merged);
+    }
+}
+
+// Keeps the first record of every key, like repeated inserts would
+void drop_duplicates(std::vector<record> & items)
+{
+    const auto last = std::unique(items.begin(), items.end(), [](const record & lhs, const record & rhs) {
+        return lhs.first == rhs.first;
+    });
+    items.erase(last, items.end());
+}
+
+template <class T>
+void put(std::string & out, const T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <class T>
+T get(const std::string_view data, std::size_t & pos)
+{
+    if (data.size() - pos < sizeof(T)) {
+        throw std::runtime_error("snapshot is truncated");
+    }
+    T res;
+    std::memcpy(&res, data.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return res;
+}
+
+// Snapshot: magic, element count, then per element the key and value sizes and their bytes
+std::size_t write_snapshot(const tree_type & tree, const std::string & path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("cannot create " + path);
+    }
+    std::string chunk(snapshot_magic, sizeof(snapshot_magic));
+    put<std::uint64_t>(chunk, tree.size());
+    std::size_t res = 0;
+    tree.scan_while(std::string_view(), [&](const auto & item) {
+        put<std::uint32_t>(chunk, static_cast<std::uint32_t>(item.first.size()));
+        put<std::uint32_t>(chunk, static_cast<std::uint32_t>(item.second.size()));
+        chunk.append(item.first).append(item.second);
+        if (chunk.size() >= output_chunk) {
+            out.write(chunk.data(), chunk.size());
+            res += chunk.size();
+            chunk.clear();
+        }
+        return true;
+    });
+    out.write(chunk.data(), chunk.size());
+    res += chunk.size();
+    if (!out.flush()) {
+        throw std::runtime_error("cannot write " + path);
+    }
+    return res;
+}
+
+std::vector<record> read_snapshot(const std::string_view data)
+{
+    if (data.size() < sizeof(snapshot_magic) || data.compare(0, sizeof(snapshot_magic), std::string_view(snapshot_magic, sizeof(snapshot_magic))) != 0) {
+        throw std::runtime_error("not a snapshot");
+    }
+    std::size_t pos = sizeof(snapshot_magic);
+    const auto count = get<std::uint64_t>(data, pos);
+    std::vector<record> res;
+    res.reserve(std::min<std::uint64_t>(count, data.size() / (2 * sizeof(std::uint32_t))));
+    for (std::uint64_t i = 0; i < count; ++i) {
+        const auto key_size = get<std::uint32_t>(data, pos);
+        const auto value_size = get<std::uint32_t>(data, pos);
+        if (data.size() - pos < std::size_t(key_size) + value_size) {
+            throw std::runtime_error("snapshot is truncated");
+        }
+        res.emplace_back(data.substr(pos, key_size), data.substr(pos + key_size, value_size));
+        pos += std::size_t(key_size) + value_size;
+    }
+    return res;
+}
+
+int build(const std::string & input, const std::string & snapshot, const std::size_t threads)
+{
+    Stopwatch watch;
+    const Mapped_file file(input);
+    auto items = split_lines(file.view());
+    watch.report("split", items.size(), file.view().size());
+    parallel_sort(items, threads);
+    drop_duplicates(items);
+    watch.report("sort", items.size());
+    const auto tree = tree_type::from_sorted(items.begin(), items.end());
+    watch.report("build", tree.size());
+    const std::size_t bytes = write_snapshot(tree, snapshot);
+    watch.report("write", tree.size(), bytes);
+    return 0;
+}
+
+// Every query line is a key, answered with "key => value" or "key not found", or a range
+// "lo<TAB>hi" answered with all elements whose keys are in [lo, hi). Point queries are looked up
+// in batches
+void answer(const tree_type & tree, const std::string_view queries, Output & out, std::size_t & answered)
+{
+    std::vector<std::string_view> keys;
+    std::vector<tree_type::const_iterator> found(query_batch);
+    const auto flush = [&] {
+        tree.find_many(keys, found.begin());
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            if (found[i] != tree.end()) {
+                out << keys[i] << " => " << found[i]->second << "\n";
+            }
+            else {
+                out << keys[i] << " not found\n";
+            }
+        }
+        answered += keys.size();
+        keys.clear();
+    };
+    for (const auto & [line, rest] : split_lines(queries)) {
+        // a line without a tab is its own value
+        if (line.data() == rest.data()) {
+            keys.push_back(line);
+            if (keys.size() == query_batch) {
+                flush();
+            }
+            continue;
+        }
+        flush();
+        tree.scan(line, rest, [&](const auto & item) {
+            out << item.first << " => " << item.second << "\n";
+        });
+        answered++;
+    }
+    flush();
+}
+
+int query(const std::string & snapshot, const std::string & queries)
+{
+    Stopwatch watch;
+    const Mapped_file file(snapshot);
+    const auto items = read_snapshot(file.view());
+    watch.report("load", items.size(), file.view().size());
+    const auto tree = tree_type::from_sorted(items.begin(), items.end());
+    watch.report("build", tree.size());
+    std::string input;
+    std::optional<Mapped_file> query_file;
+    if (queries.empty()) {
+        input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    }
+    else {
+        query_file.emplace(queries);
+    }
+    const std::string_view text = query_file ? query_file->view() : std::string_view(input);
+    std::size_t answered = 0;
+    {
+        Output out;
+        answer(tree, text, out, answered);
+    }
+    watch.report("query", answered, text.size());
+    return 0;
+}
+
+// The original loader: every line of stdin is inserted with itself twice as the value and the
+// tree is printed in order
+int print_lines()
+{
+    const std::string input(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>{});
+    auto items = split_lines(input);
+    parallel_sort(items, std::thread::hardware_concurrency());
+    drop_duplicates(items);
+    const auto tree = tree_type::from_sorted(items.begin(), items.end());
+    Output out;
+    tree.scan_while(std::string_view(), [&out](const auto & item) {
+        out << item.first << " => " << item.first << item.first << "\n";
+        return true;
+    });
+    return 0;
+}
+
+void usage()
+{
+    std::cerr << "usage: bptree                                  print stdin lines sorted\n"
+                 "       bptree build <input> <snapshot> [threads] build a snapshot from lines\n"
+                 "       bptree query <snapshot> [queries]          answer keys and ranges\n";
+}
+
+} // anonymous namespace
+
+int main(int argc, char ** argv)
 {
-    BPTree<std::string, std::string> tree;
-    std::string line;
-    while (std::getline(std::cin, line)) {
-        tree.insert(line, line + line);
+    std::ios::sync_with_stdio(false);
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    try {
+        if (args.empty()) {
+            return print_lines();
+        }
+        if (args[0] == "build" && (args.size() == 3 || args.size() == 4)) {
+            const std::size_t threads = args.size() == 4 ? std::stoull(args[3]) : std::thread::hardware_concurrency();
+            return build(args[1], args[2], threads);
+        }
+        if (args[0] == "query" && (args.size() == 2 || args.size() == 3)) {
+            return query(args[1], args.size() == 3 ? args[2] : std::string());
+        }
     }
-    for (const auto & [key, value] : tree) {
-        std::cout << key << " => " << value << "\n";
+    catch (const std::exception & e) {
+        std::cerr << "bptree: " << e.what() << "\n";
+        return 1;
     }
-}
\ No newline at end of file
+    usage();
+    return 2;
+}
@@ -0,0 +1,99 @@
+#include "buffered_tree.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+namespace {
+
+template <class Map>
+void expect_same(BufferedBPTree<int, int> & tree, const Map & map)
+{
+    for (const auto & [key, value] : map) {
+        const int * res = tree.get(key);
+        ASSERT_NE(res, nullptr) << key;
+        EXPECT_EQ(*res, value);
+    }
+    auto & flushed = tree.flushed();
+    ASSERT_EQ(flushed.size(), map.size());
+    auto it = map.begin();
+    for (const auto & [key, value] : flushed) {
+        ASSERT_EQ(key, it->first);
+        EXPECT_EQ(value, it->second);
+        ++it;
+    }
+}
+
+} // anonymous namespace
+
+TEST(BufferedTree, MatchesMap)
+{
+    std::mt19937 rng(6);
+    BufferedBPTree<int, int> tree;
+    std::map<int, int> map;
+    for (int i = 0; i < 300000; ++i) {
+        const int key = static_cast<int>(rng() % 50000);
+        switch (rng() % 3) {
+        case 0:
+            tree.insert(key, i);
+            map.emplace(key, i);
+            break;
+        case 1:
+            tree.insert_or_assign(key, i);
+            map[key] = i;
+            break;
+        default:
+            tree.erase(key);
+            map.erase(key);
+        }
+        if (i % 50000 == 0) {
+            EXPECT_EQ(tree.contains(key), map.count(key) == 1);
+        }
+    }
+    expect_same(tree, map);
+}
+
+// Waves of inserts followed by erases of most keys make flushes split and merge many siblings
+// of the children still waiting to be flushed
+TEST(BufferedTree, FlushesThatRestructure)
+{
+    std::mt19937 rng(8);
+    BufferedBPTree<int, int> tree;
+    std::map<int, int> map;
+    for (int wave = 0; wave < 6; ++wave) {
+        for (int i = 0; i < 120000; ++i) {
+            const int key = static_cast<int>(rng() % 200000);
+            tree.insert_or_assign(key, wave);
+            map[key] = wave;
+        }
+        for (int key = 0; key < 200000; ++key) {
+            if (key % 10 != wave) {
+                tree.erase(key);
+                map.erase(key);
+            }
+        }
+    }
+    expect_same(tree, map);
+}
+
+TEST(BufferedTree, PendingUpdatesAreVisible)
+{
+    BufferedBPTree<int, int> tree;
+    for (int i = 0; i < 100000; ++i) {
+        tree.insert(i, i);
+    }
+    tree.insert_or_assign(5, -5);
+    tree.erase(6);
+    tree.insert(6, 60);
+    tree.insert(7, 70);
+    EXPECT_GT(tree.pending(), 0u);
+    EXPECT_EQ(*tree.get(5), -5);
+    EXPECT_EQ(*tree.get(6), 60);
+    EXPECT_EQ(*tree.get(7), 7);
+    tree.flush();
+    EXPECT_EQ(tree.pending(), 0u);
+    EXPECT_EQ(tree.size(), 100000u);
+    EXPECT_EQ(*tree.get(6), 60);
+}
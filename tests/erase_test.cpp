@@ -0,0 +1,138 @@
+#include "bptree.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+namespace {
+
+template <class Tree, class Map>
+void expect_same(const Tree & tree, const Map & map)
+{
+    ASSERT_EQ(tree.size(), map.size());
+    auto it = map.begin();
+    for (const auto & [key, value] : tree) {
+        ASSERT_EQ(key, it->first);
+        EXPECT_EQ(value, it->second);
+        ++it;
+    }
+}
+
+} // anonymous namespace
+
+TEST(Erase, RandomAgainstMap)
+{
+    std::mt19937 rng(5);
+    BPTree<int, int> tree;
+    std::map<int, int> map;
+    for (int i = 0; i < 200000; ++i) {
+        const int key = static_cast<int>(rng() % 20000);
+        if (rng() % 2 == 0) {
+            EXPECT_EQ(tree.insert(key, i).second, map.emplace(key, i).second);
+        }
+        else {
+            EXPECT_EQ(tree.erase(key), map.erase(key));
+        }
+    }
+    expect_same(tree, map);
+}
+
+TEST(Erase, AscendingAndDescendingDrain)
+{
+    for (const bool ascending : {true, false}) {
+        BPTree<int, int> tree;
+        const int n = 30000;
+        for (int i = 0; i < n; ++i) {
+            tree.insert(i, i);
+        }
+        for (int i = 0; i < n; ++i) {
+            const int key = ascending ? i : n - 1 - i;
+            ASSERT_EQ(tree.erase(key), 1u) << key;
+            if (i % 997 == 0) {
+                EXPECT_EQ(tree.size(), static_cast<std::size_t>(n - i - 1));
+                EXPECT_FALSE(tree.contains(key));
+                if (i + 1 < n) {
+                    const int next = ascending ? key + 1 : 0;
+                    EXPECT_EQ(tree.begin()->first, next);
+                }
+            }
+        }
+        EXPECT_TRUE(tree.empty());
+        EXPECT_TRUE(tree.begin() == tree.end());
+        tree.insert(1, 1);
+        EXPECT_EQ(tree.at(1), 1);
+    }
+}
+
+TEST(Erase, IteratorReturnsNext)
+{
+    BPTree<int, int> tree;
+    for (int i = 0; i < 20000; ++i) {
+        tree.insert(i, i);
+    }
+    auto it = tree.begin();
+    int expected = 0;
+    while (it != tree.end()) {
+        ASSERT_EQ(it->first, expected);
+        // every third element is erased
+        if (expected % 3 == 0) {
+            it = tree.erase(it);
+        }
+        else {
+            ++it;
+        }
+        expected++;
+    }
+    EXPECT_EQ(tree.size(), 20000u - 6667u);
+    for (int i = 0; i < 20000; ++i) {
+        EXPECT_EQ(tree.contains(i), i % 3 != 0);
+    }
+}
+
+TEST(Erase, Ranges)
+{
+    std::mt19937 rng(9);
+    BPTree<int, int> tree;
+    std::map<int, int> map;
+    for (int i = 0; i < 50000; ++i) {
+        tree.insert(i, -i);
+        map.emplace(i, -i);
+    }
+    while (!map.empty()) {
+        const int from = static_cast<int>(rng() % 50000);
+        const int to = from + static_cast<int>(rng() % 3000);
+        const auto res = tree.erase(std::as_const(tree).lower_bound(from), std::as_const(tree).lower_bound(to));
+        map.erase(map.lower_bound(from), map.lower_bound(to));
+        EXPECT_EQ(res == tree.end(), map.lower_bound(to) == map.end());
+        ASSERT_EQ(tree.size(), map.size());
+        if (map.size() < 1000) {
+            tree.erase(tree.cbegin(), tree.cend());
+            map.clear();
+        }
+    }
+    expect_same(tree, map);
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i, i);
+    }
+    EXPECT_EQ(tree.size(), 1000u);
+}
+
+TEST(Erase, StringKeys)
+{
+    std::mt19937 rng(2);
+    BPTree<std::string, std::string> tree;
+    std::map<std::string, std::string> map;
+    for (int i = 0; i < 40000; ++i) {
+        const std::string key = std::to_string(rng() % 8000);
+        if (rng() % 3 != 0) {
+            tree.insert(key, key + "v");
+            map.emplace(key, key + "v");
+        }
+        else {
+            EXPECT_EQ(tree.erase(key), map.erase(key));
+        }
+    }
+    expect_same(tree, map);
+}
@@ -0,0 +1,97 @@
+#include "bptree.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+BPTree<int, int> even_tree(const int n)
+{
+    BPTree<int, int> tree;
+    for (int i = 0; i < n; ++i) {
+        tree.insert(2 * i, i);
+    }
+    return tree;
+}
+
+} // anonymous namespace
+
+TEST(FindMany, MatchesFind)
+{
+    const auto tree = even_tree(50000);
+    std::mt19937 rng(3);
+    std::vector<int> keys(3000);
+    for (auto & key : keys) {
+        key = static_cast<int>(rng() % 110000) - 5000;
+    }
+    for (const bool sorted : {false, true}) {
+        if (sorted) {
+            std::sort(keys.begin(), keys.end());
+        }
+        std::vector<BPTree<int, int>::const_iterator> found;
+        tree.find_many(keys, std::back_inserter(found));
+        ASSERT_EQ(found.size(), keys.size());
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            EXPECT_TRUE(found[i] == tree.find(keys[i])) << keys[i];
+        }
+    }
+}
+
+TEST(FindMany, ContainsManyWithDuplicates)
+{
+    const auto tree = even_tree(1000);
+    const std::vector<int> keys = {4, 4, 5, -2, 1998, 1998, 2000, 0, 0, 7};
+    std::vector<bool> res;
+    tree.contains_many(keys, std::back_inserter(res));
+    const std::vector<bool> expected = {true, true, false, false, true, true, false, true, true, false};
+    EXPECT_EQ(res, expected);
+}
+
+TEST(FindMany, EmptyInputs)
+{
+    BPTree<int, int> empty;
+    std::vector<bool> res;
+    empty.contains_many(std::vector<int>{1, 2, 3}, std::back_inserter(res));
+    EXPECT_EQ(res, std::vector<bool>(3, false));
+    auto tree = even_tree(10);
+    std::vector<BPTree<int, int>::iterator> found;
+    tree.find_many(std::vector<int>{}, std::back_inserter(found));
+    EXPECT_TRUE(found.empty());
+}
+
+TEST(FindMany, IteratorsAreWritable)
+{
+    auto tree = even_tree(5000);
+    std::vector<BPTree<int, int>::iterator> found;
+    tree.find_many(std::vector<int>{10, 11, 9998}, std::back_inserter(found));
+    ASSERT_EQ(found.size(), 3u);
+    EXPECT_TRUE(found[1] == tree.end());
+    found[0]->second = -1;
+    found[2]->second = -2;
+    EXPECT_EQ(tree.at(10), -1);
+    EXPECT_EQ(tree.at(9998), -2);
+}
+
+TEST(FindMany, StringKeys)
+{
+    BPTree<std::string, int> tree;
+    std::set<std::string> present;
+    for (int i = 0; i < 3000; i += 3) {
+        tree.insert(std::to_string(i), i);
+        present.insert(std::to_string(i));
+    }
+    std::vector<std::string> keys;
+    for (int i = 0; i < 3000; i += 2) {
+        keys.push_back(std::to_string(i));
+    }
+    std::vector<bool> res;
+    tree.contains_many(keys, std::back_inserter(res));
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(res[i], present.count(keys[i]) == 1) << keys[i];
+    }
+}
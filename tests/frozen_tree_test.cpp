@@ -0,0 +1,116 @@
+#include "bptree.h"
+#include "frozen_tree.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+template <class Tree, class Map>
+void expect_same(const Tree & tree, const Map & map)
+{
+    ASSERT_EQ(tree.size(), map.size());
+    auto it = map.begin();
+    for (const auto & [key, value] : tree) {
+        ASSERT_EQ(key, it->first);
+        EXPECT_EQ(value, it->second);
+        ++it;
+    }
+}
+
+} // anonymous namespace
+
+TEST(FrozenTree, FreezeMatchesTree)
+{
+    std::mt19937 rng(37);
+    BPTree<std::uint64_t, std::uint32_t> tree;
+    std::map<std::uint64_t, std::uint32_t> map;
+    for (std::uint32_t i = 0; i < 100000; ++i) {
+        const std::uint64_t key = rng() % 1000000;
+        tree.insert(key, i);
+        map.emplace(key, i);
+    }
+    const auto frozen = tree.freeze();
+    expect_same(frozen, map);
+    for (std::uint64_t key = 0; key < 1000000; key += 7) {
+        const auto it = map.lower_bound(key);
+        const auto f = frozen.lower_bound(key);
+        if (it == map.end()) {
+            ASSERT_EQ(f, frozen.end());
+            continue;
+        }
+        ASSERT_EQ(f->first, it->first);
+        ASSERT_EQ(frozen.contains(key), map.count(key) == 1);
+        const auto upper = map.upper_bound(key);
+        const auto fu = frozen.upper_bound(key);
+        ASSERT_EQ(fu == frozen.end(), upper == map.end());
+        if (upper != map.end()) {
+            ASSERT_EQ(fu->first, upper->first);
+        }
+    }
+}
+
+TEST(FrozenTree, EmptyAndSmall)
+{
+    const FrozenBPTree<int, int> empty;
+    EXPECT_TRUE(empty.empty());
+    EXPECT_EQ(empty.begin(), empty.end());
+    EXPECT_FALSE(empty.contains(1));
+    EXPECT_THROW(empty.at(1), std::out_of_range);
+
+    const std::vector<std::pair<int, int>> items{{1, 10}, {3, 30}};
+    const FrozenBPTree<int, int> small(items.begin(), items.end());
+    EXPECT_EQ(small.at(3), 30);
+    EXPECT_EQ(small.count(2), 0u);
+    EXPECT_EQ(small.lower_bound(2)->first, 3);
+    EXPECT_EQ(small.find(2), small.end());
+}
+
+TEST(FrozenTree, RejectsUnsortedInput)
+{
+    const std::vector<std::pair<int, int>> items{{2, 0}, {1, 0}};
+    EXPECT_THROW((FrozenBPTree<int, int>(items.begin(), items.end())), std::invalid_argument);
+    const std::vector<std::pair<int, int>> duplicates{{1, 0}, {1, 0}};
+    EXPECT_THROW((FrozenBPTree<int, int>(duplicates.begin(), duplicates.end())), std::invalid_argument);
+}
+
+TEST(FrozenTree, ViewOfCopiedBuffer)
+{
+    BPTree<int, int> tree;
+    for (int i = 0; i < 50000; ++i) {
+        tree.insert(2 * i, i);
+    }
+    const auto frozen = tree.freeze();
+    std::vector<std::uint64_t> copy((frozen.data_size() + 7) / 8);
+    std::memcpy(copy.data(), frozen.data(), frozen.data_size());
+    const auto view = FrozenBPTree<int, int>::view(copy.data(), frozen.data_size());
+    EXPECT_EQ(view.size(), 50000u);
+    EXPECT_EQ(view.at(4242), 2121);
+    EXPECT_FALSE(view.contains(4243));
+
+    EXPECT_THROW((FrozenBPTree<int, int>::view(copy.data(), 8)), std::invalid_argument);
+    EXPECT_THROW((FrozenBPTree<long, int>::view(copy.data(), frozen.data_size())), std::invalid_argument);
+}
+
+TEST(FrozenTree, CopiesStayValid)
+{
+    BPTree<int, int> tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i, -i);
+    }
+    FrozenBPTree<int, int> copy;
+    {
+        const auto frozen = tree.freeze();
+        copy = frozen;
+    }
+    const FrozenBPTree<int, int> moved(std::move(copy));
+    EXPECT_EQ(moved.size(), 1000u);
+    EXPECT_EQ(moved.at(999), -999);
+}
@@ -0,0 +1,107 @@
+#include "bptree.h"
+#include "key_filter.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+TEST(KeyFilter, NoFalseNegatives)
+{
+    Key_filter<int> filter(10000);
+    for (int i = 0; i < 10000; ++i) {
+        filter.add(i * 3);
+    }
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(filter.may_contain(i * 3));
+    }
+    EXPECT_FALSE(filter.stale());
+}
+
+TEST(KeyFilter, FewFalsePositives)
+{
+    Key_filter<int> filter(10000);
+    for (int i = 0; i < 10000; ++i) {
+        filter.add(i);
+    }
+    int positives = 0;
+    for (int i = 10000; i < 110000; ++i) {
+        positives += filter.may_contain(i) ? 1 : 0;
+    }
+    // 16 bits per key keep the rate well below one percent
+    EXPECT_LT(positives, 1000);
+}
+
+TEST(KeyFilter, StaleAfterOverflowOrErases)
+{
+    Key_filter<int> full(100);
+    for (int i = 0; i < 101; ++i) {
+        full.add(i);
+    }
+    EXPECT_TRUE(full.stale());
+
+    Key_filter<int> drained(100);
+    for (int i = 0; i < 100; ++i) {
+        drained.add(i);
+    }
+    for (int i = 0; i < 51; ++i) {
+        drained.erased();
+    }
+    EXPECT_TRUE(drained.stale());
+}
+
+TEST(KeyFilter, MergeNeedsSameSize)
+{
+    Key_filter<int> a(1000);
+    Key_filter<int> b(1000);
+    Key_filter<int> c(100000);
+    b.add(7);
+    EXPECT_FALSE(a.merge(c));
+    EXPECT_TRUE(a.merge(b));
+    EXPECT_TRUE(a.may_contain(7));
+}
+
+TEST(KeyFilter, FilteredTreeMatchesMap)
+{
+    std::mt19937 rng(38);
+    BPTree<std::string, int> tree;
+    tree.set_filter(true);
+    EXPECT_TRUE(tree.filtered());
+    std::map<std::string, int> map;
+    for (int i = 0; i < 100000; ++i) {
+        const std::string key = std::to_string(rng() % 20000);
+        if (rng() % 3 != 0) {
+            tree.insert(key, i);
+            map.emplace(key, i);
+        }
+        else {
+            EXPECT_EQ(tree.erase(key), map.erase(key));
+        }
+    }
+    ASSERT_EQ(tree.size(), map.size());
+    for (int i = 0; i < 40000; ++i) {
+        const std::string key = std::to_string(i);
+        ASSERT_EQ(tree.contains(key), map.count(key) == 1);
+        ASSERT_EQ(tree.count(key), map.count(key));
+    }
+    tree.set_filter(false);
+    EXPECT_FALSE(tree.filtered());
+    EXPECT_EQ(tree.contains(map.begin()->first), true);
+}
+
+TEST(KeyFilter, SurvivesClearAndCopy)
+{
+    BPTree<int, int> tree;
+    tree.set_filter(true);
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i, i);
+    }
+    const BPTree<int, int> copy(tree);
+    tree.clear();
+    EXPECT_FALSE(tree.contains(5));
+    tree.insert(5, 5);
+    EXPECT_TRUE(tree.contains(5));
+    EXPECT_TRUE(copy.filtered());
+    EXPECT_TRUE(copy.contains(999));
+}
@@ -0,0 +1,120 @@
+#include "multi_tree.h"
+
+#include <gtest/gtest.h>
+
+#include <cctype>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+template <class Tree, class Map>
+void expect_same(const Tree & tree, const Map & map)
+{
+    ASSERT_EQ(tree.size(), map.size());
+    auto it = map.begin();
+    for (const auto & [key, value] : tree) {
+        ASSERT_EQ(key, it->first);
+        EXPECT_EQ(value, it->second);
+        ++it;
+    }
+}
+
+struct case_insensitive_less
+{
+    bool operator()(const std::string & a, const std::string & b) const
+    {
+        return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](const char x, const char y) {
+            return std::tolower(static_cast<unsigned char>(x)) < std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+};
+
+} // anonymous namespace
+
+TEST(MultiTree, MatchesMultimap)
+{
+    std::mt19937 rng(4);
+    BPMultiTree<int, int> tree;
+    std::multimap<int, int> map;
+    for (int i = 0; i < 60000; ++i) {
+        const int key = static_cast<int>(rng() % 500);
+        if (rng() % 4 != 0) {
+            tree.insert(key, i);
+            map.emplace(key, i);
+        }
+        else {
+            EXPECT_EQ(tree.erase(key), map.erase(key));
+        }
+    }
+    expect_same(tree, map);
+    for (int key = 0; key < 500; ++key) {
+        EXPECT_EQ(tree.count(key), map.count(key));
+        EXPECT_EQ(tree.contains(key), map.count(key) > 0);
+    }
+}
+
+TEST(MultiTree, DuplicatesKeepInsertionOrder)
+{
+    BPMultiTree<int, std::string> tree{{1, "a"}, {2, "x"}, {1, "b"}, {1, "c"}};
+    const auto [first, last] = tree.equal_range(1);
+    std::vector<std::string> values;
+    for (auto it = first; it != last; ++it) {
+        values.push_back(it->second);
+    }
+    EXPECT_EQ(values, (std::vector<std::string>{"a", "b", "c"}));
+    EXPECT_EQ(tree.find(2)->second, "x");
+    EXPECT_TRUE(tree.find(3) == tree.end());
+}
+
+TEST(MultiTree, EraseSingleElements)
+{
+    BPMultiTree<int, int> tree;
+    for (int i = 0; i < 3000; ++i) {
+        tree.insert(i % 10, i);
+    }
+    auto it = tree.begin();
+    while (it != tree.end()) {
+        it = it->second % 2 == 0 ? tree.erase(it) : std::next(it);
+    }
+    EXPECT_EQ(tree.size(), 1500u);
+    for (const auto & [key, value] : tree) {
+        EXPECT_EQ(value % 2, 1);
+        EXPECT_EQ(value % 10, key);
+    }
+}
+
+TEST(MultiTree, UsesLess)
+{
+    BPMultiTree<int, int, std::greater<int>> tree;
+    std::multimap<int, int, std::greater<int>> map;
+    for (int i = 0; i < 5000; ++i) {
+        tree.insert(i % 97, i);
+        map.emplace(i % 97, i);
+    }
+    expect_same(tree, map);
+    EXPECT_EQ(tree.begin()->first, 96);
+    EXPECT_EQ(tree.count(5), map.count(5));
+    EXPECT_EQ(tree.erase(96), map.erase(96));
+    EXPECT_EQ(tree.begin()->first, 95);
+}
+
+TEST(MultiTree, EquivalentKeysUnderLess)
+{
+    BPMultiTree<std::string, int, case_insensitive_less> tree;
+    tree.insert("Key", 1);
+    tree.insert("b", 2);
+    tree.insert("KEY", 3);
+    tree.insert("key", 4);
+    EXPECT_EQ(tree.count("kEy"), 3u);
+    std::vector<int> values;
+    for (auto [it, last] = tree.equal_range("key"); it != last; ++it) {
+        values.push_back(it->second);
+    }
+    EXPECT_EQ(values, (std::vector<int>{1, 3, 4}));
+    EXPECT_EQ(tree.erase("KeY"), 3u);
+    EXPECT_EQ(tree.size(), 1u);
+}
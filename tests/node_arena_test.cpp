@@ -0,0 +1,104 @@
+#include "bptree.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+
+namespace {
+
+// Enables the process-wide arena for the lifetime of a test
+class Arena_scope
+{
+public:
+    Arena_scope()
+    {
+        Node_arena::instance().enable(true);
+    }
+
+    ~Arena_scope()
+    {
+        Node_arena::instance().enable(false);
+        Node_arena::instance().trim();
+    }
+};
+
+} // anonymous namespace
+
+TEST(NodeArena, DisabledByDefault)
+{
+    EXPECT_FALSE(Node_arena::instance().enabled());
+    EXPECT_EQ(Node_arena::instance().allocate(64), nullptr);
+}
+
+TEST(NodeArena, TreeNodesLiveInRegions)
+{
+    Arena_scope scope;
+    const std::size_t used = Node_arena::instance().stats().used_bytes;
+    {
+        BPTree<int, int> tree;
+        for (int i = 0; i < 100000; ++i) {
+            tree.insert(i, i);
+        }
+        const auto report = Node_arena::instance().stats();
+        EXPECT_GT(report.regions, 0u);
+        EXPECT_GT(report.used_bytes, used);
+        EXPECT_LE(report.used_bytes, report.mapped_bytes);
+        EXPECT_EQ(tree.size(), 100000u);
+        EXPECT_EQ(tree.at(4242), 4242);
+    }
+    EXPECT_EQ(Node_arena::instance().stats().used_bytes, used);
+}
+
+TEST(NodeArena, SwitchingWhileNodesLive)
+{
+    std::mt19937 rng(36);
+    BPTree<int, int> tree;
+    std::map<int, int> map;
+    {
+        Arena_scope scope;
+        for (int round = 0; round < 6; ++round) {
+            // nodes of both kinds end up in one tree and are freed by whichever mode is current
+            Node_arena::instance().enable(round % 2 == 0);
+            for (int i = 0; i < 20000; ++i) {
+                const int key = static_cast<int>(rng() % 30000);
+                if (rng() % 3 != 0) {
+                    tree.insert(key, i);
+                    map.emplace(key, i);
+                }
+                else {
+                    EXPECT_EQ(tree.erase(key), map.erase(key));
+                }
+            }
+        }
+    }
+    ASSERT_EQ(tree.size(), map.size());
+    for (const auto & [key, value] : map) {
+        ASSERT_EQ(tree.at(key), value);
+    }
+    tree.clear();
+    EXPECT_TRUE(tree.empty());
+}
+
+TEST(NodeArena, TrimReturnsEmptyRegions)
+{
+    Arena_scope scope;
+    {
+        BPTree<int, int> tree;
+        for (int i = 0; i < 50000; ++i) {
+            tree.insert(i, i);
+        }
+    }
+    EXPECT_GT(Node_arena::instance().trim(), 0u);
+    EXPECT_EQ(Node_arena::instance().stats().regions, 0u);
+}
+
+TEST(NodeArena, OversizedRequestsFallBack)
+{
+    Arena_scope scope;
+    EXPECT_EQ(Node_arena::instance().allocate(Node_arena::region_size), nullptr);
+    void * p = Node_arena::instance().allocate(100);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p) % Node_arena::cache_line, 0u);
+    Node_arena::instance().deallocate(p);
+}
@@ -0,0 +1,123 @@
+#include "bptree.h"
+#include "node_search.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Sets the process-wide policy for the lifetime of a test
+class Policy_scope
+{
+public:
+    explicit Policy_scope(const Search value)
+    {
+        Node_search::use(value);
+    }
+
+    ~Policy_scope()
+    {
+        Node_search::use(Search::binary);
+        Node_search::count(false);
+        Node_search::reset_stats();
+    }
+};
+
+template <class Key>
+void expect_bounds(const std::vector<std::pair<Key, int>> & data, const Key & key)
+{
+    const auto lower = std::lower_bound(data.begin(), data.end(), key, [](const auto & item, const Key & k) {
+        return item.first < k;
+    });
+    const auto upper = std::upper_bound(data.begin(), data.end(), key, [](const Key & k, const auto & item) {
+        return k < item.first;
+    });
+    ASSERT_EQ((Node_search::bound<false, std::less<Key>>(data, 0, data.size(), key)), std::size_t(lower - data.begin()));
+    ASSERT_EQ((Node_search::bound<true, std::less<Key>>(data, 0, data.size(), key)), std::size_t(upper - data.begin()));
+}
+
+} // anonymous namespace
+
+TEST(NodeSearch, InterpolationMatchesBinary)
+{
+    Policy_scope scope(Search::interpolation);
+    std::mt19937_64 rng(39);
+    for (int round = 0; round < 200; ++round) {
+        std::vector<std::pair<std::int64_t, int>> data(rng() % 300);
+        for (auto & item : data) {
+            // skewed rounds pack most keys at one end
+            item.first = round % 2 == 0 ? static_cast<std::int64_t>(rng() % 100000) - 50000 : static_cast<std::int64_t>((rng() % 1000) * (rng() % 1000) * (rng() % 1000));
+        }
+        std::sort(data.begin(), data.end());
+        for (int i = 0; i < 200; ++i) {
+            expect_bounds<std::int64_t>(data, static_cast<std::int64_t>(rng() % 2000000000) - 50000);
+        }
+        for (const auto & item : data) {
+            expect_bounds<std::int64_t>(data, item.first);
+        }
+    }
+}
+
+TEST(NodeSearch, FloatingPointKeys)
+{
+    Policy_scope scope(Search::interpolation);
+    std::vector<std::pair<double, int>> data;
+    for (int i = 0; i < 100; ++i) {
+        data.emplace_back(i * 0.5 - 10.0, i);
+    }
+    for (double key = -20.0; key < 60.0; key += 0.25) {
+        expect_bounds<double>(data, key);
+    }
+}
+
+TEST(NodeSearch, FewerProbesOnUniformKeys)
+{
+    Policy_scope scope(Search::binary);
+    std::vector<std::pair<std::uint64_t, int>> data;
+    for (std::uint64_t i = 0; i < 250; ++i) {
+        data.emplace_back(i * 1000, 0);
+    }
+    const auto probes = [&data](const Search policy) {
+        Node_search::use(policy);
+        Node_search::reset_stats();
+        Node_search::count(true);
+        for (std::uint64_t key = 0; key < 250000; key += 97) {
+            Node_search::bound<false, std::less<std::uint64_t>>(data, 0, data.size(), key);
+        }
+        Node_search::count(false);
+        return Node_search::stats().probes_per_search();
+    };
+    const double binary = probes(Search::binary);
+    const double interpolation = probes(Search::interpolation);
+    EXPECT_GT(binary, 0.0);
+    EXPECT_LT(interpolation, binary);
+}
+
+TEST(NodeSearch, TreeWithInterpolationMatchesMap)
+{
+    Policy_scope scope(Search::interpolation);
+    std::mt19937_64 rng(40);
+    BPTree<std::uint64_t, int> tree;
+    std::map<std::uint64_t, int> map;
+    for (int i = 0; i < 100000; ++i) {
+        const std::uint64_t key = rng() >> (i % 2 == 0 ? 0 : 40);
+        tree.insert(key, i);
+        map.emplace(key, i);
+    }
+    ASSERT_EQ(tree.size(), map.size());
+    for (int i = 0; i < 20000; ++i) {
+        const std::uint64_t key = rng() >> (i % 3 == 0 ? 0 : 40);
+        const auto it = tree.lower_bound(key);
+        const auto expected = map.lower_bound(key);
+        ASSERT_EQ(it == tree.end(), expected == map.end());
+        if (expected != map.end()) {
+            ASSERT_EQ(it->first, expected->first);
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#include "packed_tree.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+template <class Key>
+void expect_matches(const std::map<Key, std::uint32_t> & map, std::mt19937_64 & rng)
+{
+    const PackedBPTree<Key, std::uint32_t> tree(map.begin(), map.end());
+    ASSERT_EQ(tree.size(), map.size());
+    auto it = map.begin();
+    for (const auto [key, value] : tree) {
+        ASSERT_EQ(key, it->first);
+        EXPECT_EQ(value, it->second);
+        ++it;
+    }
+    for (const auto & [key, value] : map) {
+        ASSERT_TRUE(tree.contains(key)) << key;
+        EXPECT_EQ(tree.at(key), value);
+    }
+    std::vector<Key> keys;
+    for (const auto & item : map) {
+        keys.push_back(item.first);
+    }
+    for (int i = 0; i < 2000 && !keys.empty(); ++i) {
+        auto probe = keys[rng() % keys.size()];
+        probe = static_cast<Key>(probe + static_cast<Key>(rng() % 3) - 1);
+        const auto expected = map.lower_bound(probe);
+        const auto res = tree.lower_bound(probe);
+        ASSERT_EQ(res == tree.end(), expected == map.end()) << probe;
+        if (expected != map.end()) {
+            EXPECT_EQ(res->first, expected->first);
+        }
+        EXPECT_EQ(tree.contains(probe), map.count(probe) == 1);
+    }
+}
+
+} // anonymous namespace
+
+TEST(PackedTree, DenseKeys)
+{
+    std::mt19937_64 rng(1);
+    std::map<std::uint64_t, std::uint32_t> map;
+    std::uint64_t key = 1'600'000'000'000;
+    for (std::uint32_t i = 0; i < 100000; ++i) {
+        key += 1 + rng() % 1000;
+        map.emplace(key, i);
+    }
+    expect_matches(map, rng);
+    const PackedBPTree<std::uint64_t, std::uint32_t> tree(map.begin(), map.end());
+    // dense deltas pack far more entries than pair slots
+    using leaf_type = Leaf<std::uint64_t, std::uint32_t, std::less<std::uint64_t>>;
+    EXPECT_GT(map.size() / tree.leaf_count(), 2 * leaf_type::max_size);
+}
+
+TEST(PackedTree, SparseAndSignedKeys)
+{
+    std::mt19937_64 rng(2);
+    std::map<std::int64_t, std::uint32_t> map;
+    map.emplace(std::numeric_limits<std::int64_t>::min(), 0);
+    map.emplace(std::numeric_limits<std::int64_t>::max(), 1);
+    for (std::uint32_t i = 0; i < 20000; ++i) {
+        map.emplace(static_cast<std::int64_t>(rng()), i);
+    }
+    expect_matches(map, rng);
+    std::map<std::int32_t, std::uint32_t> small;
+    for (std::int32_t i = -5000; i < 5000; i += 3) {
+        small.emplace(i, static_cast<std::uint32_t>(i * i));
+    }
+    expect_matches(small, rng);
+}
+
+TEST(PackedTree, SmallTrees)
+{
+    std::mt19937_64 rng(3);
+    expect_matches(std::map<std::uint32_t, std::uint32_t>{}, rng);
+    expect_matches(std::map<std::uint32_t, std::uint32_t>{{7, 1}}, rng);
+    const PackedBPTree<std::uint32_t, std::uint32_t> empty;
+    EXPECT_TRUE(empty.empty());
+    EXPECT_TRUE(empty.begin() == empty.end());
+    EXPECT_FALSE(empty.contains(0));
+    EXPECT_THROW(empty.at(0), std::out_of_range);
+}
+
+TEST(PackedTree, FromBPTree)
+{
+    BPTree<std::uint32_t, std::uint16_t> tree;
+    for (std::uint32_t i = 0; i < 30000; ++i) {
+        tree.insert(i * 5, static_cast<std::uint16_t>(i));
+    }
+    const PackedBPTree<std::uint32_t, std::uint16_t> packed(tree);
+    EXPECT_EQ(packed.size(), tree.size());
+    EXPECT_EQ(packed.at(500), 100);
+    EXPECT_FALSE(packed.contains(501));
+    EXPECT_EQ(packed.upper_bound(500)->first, 505u);
+}
+
+TEST(PackedTree, RejectsUnsortedInput)
+{
+    const std::vector<std::pair<int, int>> items = {{1, 1}, {3, 3}, {2, 2}};
+    EXPECT_THROW((PackedBPTree<int, int>(items.begin(), items.end())), std::invalid_argument);
+    const std::vector<std::pair<int, int>> duplicates = {{1, 1}, {1, 2}};
+    EXPECT_THROW((PackedBPTree<int, int>(duplicates.begin(), duplicates.end())), std::invalid_argument);
+}
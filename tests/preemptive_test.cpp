@@ -0,0 +1,101 @@
+#include "bptree.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+namespace {
+
+template <class Tree, class Map>
+void expect_same(const Tree & tree, const Map & map)
+{
+    ASSERT_EQ(tree.size(), map.size());
+    auto it = map.begin();
+    for (const auto & [key, value] : tree) {
+        ASSERT_EQ(key, it->first);
+        EXPECT_EQ(value, it->second);
+        ++it;
+    }
+}
+
+} // anonymous namespace
+
+TEST(Preemptive, MatchesMap)
+{
+    std::mt19937 rng(14);
+    BPTree<int, int> tree;
+    tree.set_preemptive(true);
+    EXPECT_TRUE(tree.preemptive());
+    std::map<int, int> map;
+    for (int i = 0; i < 200000; ++i) {
+        const int key = static_cast<int>(rng() % 30000);
+        if (rng() % 2 == 0) {
+            EXPECT_EQ(tree.insert(key, i).second, map.emplace(key, i).second);
+        }
+        else {
+            EXPECT_EQ(tree.erase(key), map.erase(key));
+        }
+    }
+    expect_same(tree, map);
+}
+
+TEST(Preemptive, SequentialFillAndDrain)
+{
+    BPTree<int, int> tree;
+    tree.set_preemptive(true);
+    for (int i = 0; i < 100000; ++i) {
+        tree.insert(i, i);
+    }
+    EXPECT_EQ(tree.size(), 100000u);
+    for (int i = 99999; i >= 0; i -= 2) {
+        ASSERT_EQ(tree.erase(i), 1u);
+    }
+    for (int i = 0; i < 100000; i += 2) {
+        ASSERT_EQ(tree.erase(i), 1u);
+    }
+    EXPECT_TRUE(tree.empty());
+    tree.insert(3, 3);
+    EXPECT_EQ(tree.at(3), 3);
+}
+
+TEST(Preemptive, EraseByIterator)
+{
+    BPTree<int, int> tree;
+    tree.set_preemptive(true);
+    for (int i = 0; i < 20000; ++i) {
+        tree.insert(i, i);
+    }
+    auto it = tree.begin();
+    int expected = 0;
+    while (it != tree.end()) {
+        ASSERT_EQ(it->first, expected);
+        it = expected % 2 == 0 ? tree.erase(it) : std::next(it);
+        expected++;
+    }
+    EXPECT_EQ(tree.size(), 10000u);
+    EXPECT_FALSE(tree.contains(0));
+    EXPECT_TRUE(tree.contains(1));
+}
+
+TEST(Preemptive, SwitchingModes)
+{
+    std::mt19937 rng(15);
+    BPTree<std::string, int> tree;
+    std::map<std::string, int> map;
+    for (int round = 0; round < 10; ++round) {
+        tree.set_preemptive(round % 2 == 0);
+        for (int i = 0; i < 10000; ++i) {
+            const std::string key = std::to_string(rng() % 5000);
+            if (rng() % 3 != 0) {
+                tree.insert(key, i);
+                map.emplace(key, i);
+            }
+            else {
+                EXPECT_EQ(tree.erase(key), map.erase(key));
+            }
+        }
+    }
+    expect_same(tree, map);
+}
@@ -0,0 +1,114 @@
+#include "sharded_tree.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+TEST(ShardedTree, MatchesMap)
+{
+    std::mt19937 rng(12);
+    ShardedBPTree<int, int> tree({1000, 5000, 9000});
+    std::map<int, int> map;
+    for (int i = 0; i < 100000; ++i) {
+        const int key = static_cast<int>(rng() % 12000);
+        if (rng() % 3 != 0) {
+            EXPECT_EQ(tree.insert(key, i), map.emplace(key, i).second);
+        }
+        else {
+            EXPECT_EQ(tree.erase(key), map.erase(key));
+        }
+    }
+    ASSERT_EQ(tree.size(), map.size());
+    auto it = map.begin();
+    for (const auto & [key, value] : tree) {
+        ASSERT_EQ(key, it->first);
+        EXPECT_EQ(value, it->second);
+        ++it;
+    }
+    EXPECT_EQ(tree.lower_bound(4999)->first, map.lower_bound(4999)->first);
+}
+
+TEST(ShardedTree, SplitPoints)
+{
+    std::vector<int> sample;
+    for (int i = 0; i < 1000; ++i) {
+        sample.push_back(i % 10 == 0 ? 5 : i);
+    }
+    const auto points = ShardedBPTree<int, int>::split_points(sample, 4);
+    EXPECT_TRUE(std::is_sorted(points.begin(), points.end()));
+    EXPECT_EQ(std::adjacent_find(points.begin(), points.end()), points.end());
+    EXPECT_LE(points.size(), 3u);
+}
+
+TEST(ShardedTree, RebalanceEvensOutSkew)
+{
+    ShardedBPTree<int, int> tree({100, 200, 300});
+    // nearly everything lands in the last shard
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(i, i);
+    }
+    for (int i = 300; i < 200000; ++i) {
+        tree.insert(i, i);
+    }
+    const std::size_t size = tree.size();
+    for (int round = 0; round < 20; ++round) {
+        tree.rebalance();
+    }
+    EXPECT_EQ(tree.size(), size);
+    for (int i = 0; i < 200000; ++i) {
+        if (i < 100 || i >= 300) {
+            ASSERT_EQ(tree.get(i), i) << i;
+        }
+        else {
+            ASSERT_FALSE(tree.contains(i));
+        }
+    }
+    int previous = -1;
+    for (const auto & item : tree) {
+        ASSERT_LT(previous, item.first);
+        previous = item.first;
+    }
+    // new keys go to the shards that now own their range
+    tree.insert(150, 150);
+    EXPECT_TRUE(tree.contains(150));
+    EXPECT_EQ(tree.erase(150000), 1u);
+    EXPECT_EQ(tree.size(), size);
+}
+
+TEST(ShardedTree, RebalanceWithConcurrentReaders)
+{
+    ShardedBPTree<int, int> tree({1000, 2000, 3000});
+    for (int i = 3000; i < 100000; i += 2) {
+        tree.insert(i, i);
+    }
+    std::atomic<bool> done{false};
+    std::atomic<int> missing{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; ++t) {
+        readers.emplace_back([&, t] {
+            std::mt19937 rng(t);
+            while (!done.load()) {
+                const int key = 3000 + 2 * static_cast<int>(rng() % 48500);
+                if (!tree.contains(key)) {
+                    missing++;
+                }
+                tree.insert(1 + 2 * static_cast<int>(rng() % 50000), 0);
+            }
+        });
+    }
+    for (int round = 0; round < 50; ++round) {
+        tree.rebalance(1.5);
+    }
+    done = true;
+    for (auto & reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(missing.load(), 0);
+    for (int i = 3000; i < 100000; i += 2) {
+        ASSERT_TRUE(tree.contains(i)) << i;
+    }
+}
@@ -0,0 +1,144 @@
+#include "bptree.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+using tree_type = BPTree<int, int>;
+
+tree_type make_tree(const int from, const int to, const int step = 1)
+{
+    tree_type tree;
+    for (int i = from; i < to; i += step) {
+        tree.insert(i, -i);
+    }
+    return tree;
+}
+
+void expect_range(const tree_type & tree, const int from, const int to, const int step = 1)
+{
+    EXPECT_EQ(tree.size(), static_cast<std::size_t>((to - from + step - 1) / step));
+    int expected = from;
+    for (const auto & [key, value] : tree) {
+        ASSERT_EQ(key, expected);
+        EXPECT_EQ(value, -key);
+        expected += step;
+    }
+    EXPECT_EQ(expected, from < to ? from + step * ((to - from + step - 1) / step) : from);
+}
+
+} // anonymous namespace
+
+TEST(SplitJoin, SplitAtEveryPosition)
+{
+    for (const int n : {0, 1, 300, 5000}) {
+        for (const int at : {-1, 0, 1, n / 3, n / 2, n - 1, n, n + 10}) {
+            auto tree = make_tree(0, n);
+            auto rest = tree.split_at(at);
+            const int cut = std::clamp(at, 0, n);
+            expect_range(tree, 0, cut);
+            expect_range(rest, cut, n);
+            tree.insert(-5, 5);
+            rest.insert(n + 5, -n - 5);
+            EXPECT_TRUE(tree.contains(-5));
+            EXPECT_TRUE(rest.contains(n + 5));
+        }
+    }
+}
+
+TEST(SplitJoin, JoinRestoresSplit)
+{
+    std::mt19937 rng(11);
+    for (int round = 0; round < 30; ++round) {
+        const int n = static_cast<int>(rng() % 20000);
+        auto tree = make_tree(0, n);
+        auto rest = tree.split_at(static_cast<int>(rng() % (n + 1)));
+        if (round % 2 == 0) {
+            tree.join(rest);
+            expect_range(tree, 0, n);
+            EXPECT_TRUE(rest.empty());
+        }
+        else {
+            rest.join(tree);
+            expect_range(rest, 0, n);
+            EXPECT_TRUE(tree.empty());
+        }
+    }
+}
+
+TEST(SplitJoin, JoinTreesOfDifferentHeights)
+{
+    for (const int small : {1, 10, 400}) {
+        auto big = make_tree(0, 100000);
+        auto low = make_tree(-small, 0);
+        big.join(low);
+        expect_range(big, -small, 100000);
+        auto high = make_tree(100000, 100000 + small);
+        big.join(high);
+        expect_range(big, -small, 100000 + small);
+        auto tiny = make_tree(-small - 10, -small);
+        tiny.join(big);
+        expect_range(tiny, -small - 10, 100000 + small);
+    }
+}
+
+TEST(SplitJoin, OverlappingJoinThrows)
+{
+    auto tree = make_tree(0, 100, 2);
+    auto other = make_tree(51, 200, 2);
+    EXPECT_THROW(tree.join(other), std::invalid_argument);
+    expect_range(tree, 0, 100, 2);
+    expect_range(other, 51, 200, 2);
+}
+
+TEST(SplitJoin, JoinKeepsSettings)
+{
+    for (const int order : {0, 1, 2}) {
+        tree_type tree = order == 2 ? tree_type() : make_tree(0, 3000);
+        tree_type other = order == 1 ? make_tree(-3000, 0) : make_tree(3000, 6000);
+        tree.set_filter(true);
+        tree.set_preemptive(true);
+        tree.set_hot_cache(1024);
+        for (int i = 0; i < 100; ++i) {
+            tree.find(i);
+        }
+        other.set_hot_cache(64);
+
+        tree.join(other);
+        EXPECT_TRUE(tree.filtered());
+        EXPECT_TRUE(tree.preemptive());
+        EXPECT_EQ(tree.hot_cache_capacity(), 1024u);
+        EXPECT_FALSE(other.filtered());
+        EXPECT_FALSE(other.preemptive());
+        EXPECT_EQ(other.hot_cache_capacity(), 64u);
+        EXPECT_TRUE(other.empty());
+
+        const int from = order == 1 ? -3000 : order == 2 ? 3000 : 0;
+        const int to = order == 1 ? 3000 : 6000;
+        expect_range(tree, from, to);
+        for (int i = from; i < to; i += 7) {
+            EXPECT_TRUE(tree.contains(i)) << i;
+            EXPECT_EQ(tree.find(i)->second, -i);
+        }
+        other.insert(1, 1);
+        EXPECT_EQ(other.at(1), 1);
+    }
+}
+
+TEST(SplitJoin, SplitKeepsSettings)
+{
+    auto tree = make_tree(0, 10000);
+    tree.set_filter(true);
+    tree.set_hot_cache(256);
+    auto rest = tree.split_at(4000);
+    EXPECT_TRUE(rest.filtered());
+    EXPECT_EQ(rest.hot_cache_capacity(), 256u);
+    for (int i = 0; i < 10000; i += 13) {
+        EXPECT_EQ(tree.contains(i), i < 4000);
+        EXPECT_EQ(rest.contains(i), i >= 4000);
+    }
+}
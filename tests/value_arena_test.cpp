@@ -0,0 +1,151 @@
+#include "bptree.h"
+#include "sharded_tree.h"
+#include "string_tree.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+namespace {
+
+// Too big to stay in a leaf slot, counts the live instances
+struct Big
+{
+    static inline int live = 0;
+
+    Big(const int value = 0)
+        : value(value)
+    {
+        live++;
+    }
+
+    Big(const Big & other)
+        : value(other.value)
+    {
+        live++;
+    }
+
+    Big & operator=(const Big &) = default;
+
+    ~Big()
+    {
+        live--;
+    }
+
+    int value;
+    char payload[128] = {};
+};
+
+} // anonymous namespace
+
+TEST(ValueArena, LargeValuesAreKeptOutOfLine)
+{
+    using slot = leaf_slot<int, Big>;
+    static_assert(slot::out_of_line);
+    static_assert(std::is_same_v<slot::type, std::pair<int, Big *>>);
+    static_assert(!leaf_slot<int, int>::out_of_line);
+    EXPECT_GT((Leaf<int, Big, std::less<int>>::max_size), 200u);
+}
+
+TEST(ValueArena, MatchesMap)
+{
+    std::mt19937 rng(1);
+    {
+        BPTree<int, Big> tree;
+        std::map<int, int> map;
+        for (int i = 0; i < 20000; ++i) {
+            const int key = rng() % 5000;
+            if (rng() % 3 != 0) {
+                EXPECT_EQ(tree.insert(key, Big(i)).second, map.emplace(key, i).second);
+            }
+            else {
+                EXPECT_EQ(tree.erase(key), map.erase(key));
+            }
+        }
+        ASSERT_EQ(tree.size(), map.size());
+        auto it = tree.begin();
+        for (const auto & [key, value] : map) {
+            EXPECT_EQ(it->first, key);
+            EXPECT_EQ(it->second.value, value);
+            ++it;
+        }
+        EXPECT_EQ(Big::live, static_cast<int>(map.size()));
+    }
+    EXPECT_EQ(Big::live, 0);
+}
+
+TEST(ValueArena, ValuesAreWritableThroughIterators)
+{
+    BPTree<int, Big> tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(i, Big(i));
+    }
+    for (auto && item : tree) {
+        item.second.value *= 2;
+    }
+    tree.find(7)->second.value = -1;
+    tree[8].value = -2;
+    EXPECT_EQ(tree.at(7).value, -1);
+    EXPECT_EQ(tree.at(8).value, -2);
+    EXPECT_EQ(tree.at(999).value, 1998);
+}
+
+TEST(ValueArena, ValuesAreDestroyedOnce)
+{
+    {
+        BPTree<int, Big> tree;
+        for (int i = 0; i < 5000; ++i) {
+            tree.insert(i, Big(i));
+        }
+        BPTree<int, Big> copy(tree);
+        EXPECT_EQ(Big::live, 10000);
+        copy.erase_if([](const auto & item) {
+            return item.first % 2 == 0;
+        });
+        EXPECT_EQ(Big::live, 7500);
+        tree.erase(std::as_const(tree).find(10), std::as_const(tree).find(110));
+        EXPECT_EQ(Big::live, 7400);
+        tree.clear();
+        EXPECT_EQ(Big::live, 2500);
+        BPTree<int, Big> rest = copy.split_at(2500);
+        copy.join(rest);
+        EXPECT_EQ(copy.size(), 2500u);
+    }
+    EXPECT_EQ(Big::live, 0);
+}
+
+TEST(ValueArena, StringTreeKeysSurviveCompaction)
+{
+    StringBPTree<Big> tree;
+    for (int i = 0; i < 2000; ++i) {
+        tree.insert("key number " + std::to_string(i), Big(i));
+    }
+    for (int i = 0; i < 2000; i += 2) {
+        tree.erase("key number " + std::to_string(i));
+    }
+    tree.compact();
+    for (int i = 1; i < 2000; i += 2) {
+        const std::string key = "key number " + std::to_string(i);
+        ASSERT_TRUE(tree.contains(key));
+        EXPECT_EQ(tree.at(key).value, i);
+    }
+}
+
+TEST(ValueArena, ShardedIterators)
+{
+    ShardedBPTree<int, Big> tree({100, 200});
+    for (int i = 0; i < 300; ++i) {
+        tree.insert(i, Big(i));
+    }
+    int expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        EXPECT_EQ(it->first, expected);
+        EXPECT_EQ((*it).second.value, expected);
+        it->second.value = -expected;
+        expected++;
+    }
+    EXPECT_EQ(expected, 300);
+    EXPECT_EQ(tree.get(150)->value, -150);
+}
@@ -0,0 +1,106 @@
+#include "bptree.h"
+#include "write_batch.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+namespace {
+
+template <class Tree, class Map>
+void expect_same(const Tree & tree, const Map & map)
+{
+    ASSERT_EQ(tree.size(), map.size());
+    auto it = map.begin();
+    for (const auto & [key, value] : tree) {
+        ASSERT_EQ(key, it->first);
+        EXPECT_EQ(value, it->second);
+        ++it;
+    }
+}
+
+} // anonymous namespace
+
+TEST(WriteBatch, LastOperationWins)
+{
+    WriteBatch<int, int> batch;
+    batch.put(1, 10);
+    batch.put(2, 20);
+    batch.erase(1);
+    batch.put(2, 21);
+    batch.erase(3);
+    batch.put(3, 30);
+    EXPECT_EQ(batch.size(), 6u);
+
+    BPTree<int, int> tree;
+    tree.insert(3, 0);
+    tree.insert(4, 40);
+    tree.apply(std::move(batch));
+    expect_same(tree, std::map<int, int>{{2, 21}, {3, 30}, {4, 40}});
+}
+
+TEST(WriteBatch, TakeSortedFoldsAndEmpties)
+{
+    WriteBatch<int, int> batch;
+    batch.put(5, 1);
+    batch.put(1, 1);
+    batch.put(5, 2);
+    const auto items = batch.take_sorted();
+    ASSERT_EQ(items.size(), 2u);
+    EXPECT_EQ(items[0].key, 1);
+    EXPECT_EQ(items[1].key, 5);
+    EXPECT_TRUE(batch.empty());
+}
+
+TEST(WriteBatch, EmptyBatchChangesNothing)
+{
+    BPTree<int, int> tree;
+    tree.insert(1, 1);
+    tree.apply(WriteBatch<int, int>());
+    expect_same(tree, std::map<int, int>{{1, 1}});
+}
+
+TEST(WriteBatch, RandomBatchesMatchMap)
+{
+    std::mt19937 rng(21);
+    BPTree<int, int> tree;
+    std::map<int, int> map;
+    for (int round = 0; round < 200; ++round) {
+        WriteBatch<int, int> batch;
+        const int count = static_cast<int>(rng() % 2000);
+        for (int i = 0; i < count; ++i) {
+            const int key = static_cast<int>(rng() % 50000);
+            if (rng() % 3 != 0) {
+                batch.put(key, i);
+                map[key] = i;
+            }
+            else {
+                batch.erase(key);
+                map.erase(key);
+            }
+        }
+        tree.apply(std::move(batch));
+    }
+    expect_same(tree, map);
+}
+
+TEST(WriteBatch, DrainsTreeToEmpty)
+{
+    BPTree<std::string, int> tree;
+    WriteBatch<std::string, int> fill;
+    for (int i = 0; i < 30000; ++i) {
+        fill.put(std::to_string(i), i);
+    }
+    tree.apply(std::move(fill));
+    EXPECT_EQ(tree.size(), 30000u);
+    WriteBatch<std::string, int> drain;
+    for (int i = 0; i < 30000; ++i) {
+        drain.erase(std::to_string(i));
+    }
+    tree.apply(std::move(drain));
+    EXPECT_TRUE(tree.empty());
+    tree.insert("a", 1);
+    EXPECT_EQ(tree.at("a"), 1);
+}